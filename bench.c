@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// Benchmark driver: runs part2b over a grid of TA counts, exam counts and
+// questions per exam, repeats every configuration, and reports throughput,
+// exam latency and CPU use. Each run gets a fresh scratch directory with
+// generated exams and rubric, and its metrics come from part2b --json.
+
+#define MAX_VALUES 16
+
+typedef struct {
+    double wall_s;        // wall-clock time of the whole run
+    double makespan_s;    // TA start to last TA done, from part2b
+    double cpu_s;         // user + system time of part2b and its children
+    int    exams;         // exams fully marked
+    double p50_ms;        // exam latency percentiles (load -> all marked)
+    double p99_ms;
+    int    claim_retries; // question claims lost to another TA
+} RunResult;
+
+/* ---------------- helpers ---------------- */
+
+// Parses "2,4,8" into values. Returns the count, or -1 on a bad list.
+int parse_list(const char *s, int *values) {
+    int n = 0;
+    char *end;
+    while (*s) {
+        if (n == MAX_VALUES) return -1;
+        long v = strtol(s, &end, 10);
+        if (end == s || v < 1) return -1;
+        values[n++] = (int)v;
+        s = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return -1;
+    }
+    return n;
+}
+
+double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int write_text_file(const char *dir, const char *name, const char *text) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+    fputs(text, f);
+    return fclose(f);
+}
+
+// Fills dir with a rubric and n exams, numbered from 1 by file name. The
+// last one holds student 9999 so the run stops after it; no other exam
+// may, so number 9999 is skipped.
+int make_run_dir(const char *dir, int n) {
+    if (write_text_file(dir, "rubric.txt", "1,A\n2,B\n3,C\n4,D\n5,E\n") != 0) {
+        return -1;
+    }
+
+    char exam_dir[PATH_MAX];
+    snprintf(exam_dir, sizeof(exam_dir), "%s/exams", dir);
+    if (mkdir(exam_dir, 0755) != 0) {
+        perror("mkdir exams");
+        return -1;
+    }
+
+    for (int i = 1; i <= n; i++) {
+        int student = i < 9999 ? i : i + 1;
+        char name[32], text[32];
+        snprintf(name, sizeof(name), "%04d", student);
+        snprintf(text, sizeof(text), "%04d\n", i == n ? 9999 : student);
+        if (write_text_file(exam_dir, name, text) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Removes every file in dir (one level of subdirectories), then dir.
+void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (unlink(path) != 0) {
+            remove_dir(path);
+        }
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+// Finds "key": <number> in the JSON text, after `section` if given.
+double json_number(const char *json, const char *section, const char *key) {
+    const char *p = json;
+    if (section && !(p = strstr(json, section))) {
+        return NAN;
+    }
+
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    p = strstr(p, pattern);
+    return p ? strtod(p + strlen(pattern), NULL) : NAN;
+}
+
+/* ---------------- one run ---------------- */
+
+// Runs part2b once in a fresh scratch directory. Returns 0 on success.
+int run_once(const char *bin, int tas, int exams, int questions, const char *scale,
+             int seed, char **extra, int num_extra, RunResult *out) {
+    char dir[] = "/tmp/bench_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return -1;
+    }
+    if (make_run_dir(dir, exams) != 0) {
+        remove_dir(dir);
+        return -1;
+    }
+
+    char tas_arg[16], questions_arg[16], seed_arg[16];
+    snprintf(tas_arg, sizeof(tas_arg), "%d", tas);
+    snprintf(questions_arg, sizeof(questions_arg), "%d", questions);
+    snprintf(seed_arg, sizeof(seed_arg), "%d", seed);
+
+    char *argv[32 + MAX_VALUES];
+    int argc = 0;
+    argv[argc++] = (char *)bin;
+    argv[argc++] = "--json";
+    argv[argc++] = "metrics.json";
+    argv[argc++] = "--questions";
+    argv[argc++] = questions_arg;
+    argv[argc++] = "--delay-scale";
+    argv[argc++] = (char *)scale;
+    argv[argc++] = "--seed";
+    argv[argc++] = seed_arg;
+    for (int i = 0; i < num_extra && argc < 30 + MAX_VALUES; i++) {
+        argv[argc++] = extra[i];
+    }
+    argv[argc++] = tas_arg;
+    argv[argc] = NULL;
+
+    double start = now_s();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        remove_dir(dir);
+        return -1;
+    } else if (pid == 0) {
+        // the run's log goes nowhere; only the metrics file matters
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (chdir(dir) != 0 || null_fd < 0) {
+            perror("bench child");
+            exit(127);
+        }
+        dup2(null_fd, STDOUT_FILENO);
+        execv(bin, argv);
+        perror("execv");
+        exit(127);
+    }
+
+    // wait4's usage covers part2b and every TA, loader and writer it reaped
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        perror("wait4");
+        remove_dir(dir);
+        return -1;
+    }
+    out->wall_s = now_s() - start;
+    out->cpu_s = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+                 ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/metrics.json", dir);
+    FILE *f = fopen(path, "r");
+    char *json = NULL;
+    size_t len = 0;
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        len = ftell(f);
+        rewind(f);
+        json = calloc(1, len + 1);
+        if (json && fread(json, 1, len, f) != len) {
+            free(json);
+            json = NULL;
+        }
+        fclose(f);
+    }
+    remove_dir(dir);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !json) {
+        fprintf(stderr, "part2b run failed (status %d)\n", status);
+        free(json);
+        return -1;
+    }
+
+    out->makespan_s = json_number(json, NULL, "makespan_us") / 1e6;
+    out->claim_retries = (int)json_number(json, NULL, "claim_retries"); // run total comes first
+    out->exams = (int)json_number(json, "\"exam_latency\"", "count");
+    out->p50_ms = json_number(json, "\"exam_latency\"", "p50_us") / 1e3;
+    out->p99_ms = json_number(json, "\"exam_latency\"", "p99_us") / 1e3;
+    free(json);
+    return 0;
+}
+
+/* ---------------- main ---------------- */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b part2b] [-t tas] [-e exams] [-q questions] [-x delay_scale]\n"
+                    "          [-r repeats] [-o results.csv] [-- part2b options...]\n"
+                    "Lists are comma separated, e.g. -t 2,4,8,16\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *bin = "./part2b";
+    const char *scale = "0.01";
+    const char *csv_path = NULL;
+    int repeats = 3;
+    int tas[MAX_VALUES] = {2, 4, 8}, num_tas = 3;
+    int exams[MAX_VALUES] = {25}, num_exams = 1;
+    int questions[MAX_VALUES] = {5}, num_questions = 1;
+
+    static const struct option long_opts[] = {
+        {"binary",      required_argument, NULL, 'b'},
+        {"tas",         required_argument, NULL, 't'},
+        {"exams",       required_argument, NULL, 'e'},
+        {"questions",   required_argument, NULL, 'q'},
+        {"delay-scale", required_argument, NULL, 'x'},
+        {"repeats",     required_argument, NULL, 'r'},
+        {"csv",         required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:t:e:q:x:r:o:", long_opts, NULL)) != -1) {
+        int bad = 0;
+        switch (opt) {
+        case 'b':
+            bin = optarg;
+            break;
+        case 't':
+            bad = (num_tas = parse_list(optarg, tas)) < 0;
+            break;
+        case 'e':
+            bad = (num_exams = parse_list(optarg, exams)) < 0;
+            break;
+        case 'q':
+            bad = (num_questions = parse_list(optarg, questions)) < 0;
+            break;
+        case 'x':
+            scale = optarg;
+            bad = atof(scale) <= 0;
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            bad = repeats < 1;
+            break;
+        case 'o':
+            csv_path = optarg;
+            break;
+        default:
+            bad = 1;
+        }
+        if (bad) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // the child chdirs into its scratch directory, so resolve the binary now
+    char bin_path[PATH_MAX];
+    if (!realpath(bin, bin_path)) {
+        perror(bin);
+        return 1;
+    }
+
+    char **extra = argv + optind;
+    int num_extra = argc - optind;
+    if (num_extra > MAX_VALUES) {
+        fprintf(stderr, "Too many part2b options\n");
+        return 1;
+    }
+
+    FILE *csv = NULL;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            perror("fopen csv");
+            return 1;
+        }
+        fprintf(csv, "tas,exams,questions,delay_scale,repeat,wall_s,makespan_s,cpu_s,"
+                     "exams_marked,throughput,p50_ms,p99_ms,claim_retries\n");
+    }
+
+    printf("part2b benchmark: %s, delay scale %s, %d repeats", bin_path, scale, repeats);
+    for (int i = 0; i < num_extra; i++) {
+        printf(" %s", extra[i]);
+    }
+    printf("\n\n   TAs  exams    qs  exams/s (±sd)      p50 ms    p99 ms   CPU s  CPU%%  retries/exam\n");
+    fflush(stdout);
+
+    for (int ti = 0; ti < num_tas; ti++) {
+        for (int ei = 0; ei < num_exams; ei++) {
+            for (int qi = 0; qi < num_questions; qi++) {
+                double sum_tp = 0, sum_tp2 = 0, sum_p50 = 0, sum_p99 = 0;
+                double sum_cpu = 0, sum_wall = 0, sum_retries = 0;
+                int ok = 0;
+
+                for (int r = 0; r < repeats; r++) {
+                    RunResult res;
+                    if (run_once(bin_path, tas[ti], exams[ei], questions[qi], scale,
+                                 r + 1, extra, num_extra, &res) != 0) {
+                        continue;
+                    }
+
+                    double tp = res.makespan_s > 0 ? res.exams / res.makespan_s : 0;
+                    sum_tp += tp;
+                    sum_tp2 += tp * tp;
+                    sum_p50 += res.p50_ms;
+                    sum_p99 += res.p99_ms;
+                    sum_cpu += res.cpu_s;
+                    sum_wall += res.wall_s;
+                    sum_retries += res.exams > 0 ? (double)res.claim_retries / res.exams : 0;
+                    ok++;
+
+                    if (csv) {
+                        fprintf(csv, "%d,%d,%d,%s,%d,%.4f,%.4f,%.4f,%d,%.3f,%.3f,%.3f,%d\n",
+                                tas[ti], exams[ei], questions[qi], scale, r + 1, res.wall_s,
+                                res.makespan_s, res.cpu_s, res.exams, tp, res.p50_ms,
+                                res.p99_ms, res.claim_retries);
+                    }
+                }
+
+                if (ok == 0) {
+                    printf("  %4d  %5d  %4d  (every run failed)\n", tas[ti], exams[ei], questions[qi]);
+                    continue;
+                }
+
+                double mean_tp = sum_tp / ok;
+                double var = sum_tp2 / ok - mean_tp * mean_tp;
+                printf("  %4d  %5d  %4d  %8.2f (±%6.2f)  %8.1f  %8.1f  %6.2f  %4.0f  %12.2f\n",
+                       tas[ti], exams[ei], questions[qi], mean_tp, var > 0 ? sqrt(var) : 0.0,
+                       sum_p50 / ok, sum_p99 / ok, sum_cpu / ok,
+                       sum_wall > 0 ? 100.0 * sum_cpu / sum_wall : 0.0, sum_retries / ok);
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+    return 0;
+}
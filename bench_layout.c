@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+// Microbenchmark for the shared-region layout: N forked "TAs" hammer the
+// same fields part2b's TAs touch (poll `finished`, bump a per-TA counter,
+// take one of three semaphores) with no sleeps, once with everything
+// packed into adjacent bytes as the original SharedData had it, and once
+// with hot fields on their own cache lines. Reports operations per second.
+
+#define CACHE_LINE  64
+#define MAX_TAS     256
+#define SEM_EVERY   8   // iterations between semaphore round trips
+
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+
+// Original layout: flags, semaphores and per-TA counters share lines.
+typedef struct {
+    char rubric[5][20];
+    int  questions_marked[5];
+    int  current_exam_index;
+    int  student_id;
+    int  finished;
+    sem_t rubric_sem;
+    sem_t questions_sem;
+    sem_t exam_sem;
+    long long ops[MAX_TAS];
+} PackedShared;
+
+// Padded layout: everything a TA writes or polls has its own line.
+typedef struct {
+    CACHE_ALIGNED long long value;
+} PaddedCounter;
+
+typedef struct {
+    char rubric[5][20];
+    CACHE_ALIGNED int finished;
+    CACHE_ALIGNED int questions_marked[5];
+    int  current_exam_index;
+    int  student_id;
+    CACHE_ALIGNED sem_t rubric_sem;
+    CACHE_ALIGNED sem_t questions_sem;
+    CACHE_ALIGNED sem_t exam_sem;
+    PaddedCounter ops[MAX_TAS];
+} PaddedShared;
+
+// The fields one TA uses, wherever the layout put them.
+typedef struct {
+    volatile int *finished;
+    long long    *ops;
+    sem_t        *sem;
+} TaView;
+
+/* ---------------- benchmark ---------------- */
+
+// A TA's loop without the sleeps: poll, count, and every SEM_EVERY
+// iterations a semaphore round trip on its own semaphore.
+void ta_loop(TaView v) {
+    long long n = 0;
+    while (!*v.finished) {
+        if (++n % SEM_EVERY == 0) {
+            sem_wait(v.sem);
+            sem_post(v.sem);
+        }
+        (*v.ops)++;
+    }
+}
+
+double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Forks num_tas TAs on the views, lets them run for `seconds` and
+// returns total operations per second.
+double run_layout(TaView *views, int num_tas, volatile int *finished, double seconds) {
+    pid_t pids[MAX_TAS];
+
+    *finished = 0;
+    fflush(stdout); // children must not inherit buffered output
+    for (int i = 0; i < num_tas; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("fork");
+            exit(1);
+        } else if (pids[i] == 0) {
+            ta_loop(views[i]);
+            exit(0);
+        }
+    }
+
+    double start = now_s();
+    usleep((useconds_t)(seconds * 1e6));
+    *finished = 1;
+    for (int i = 0; i < num_tas; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+    double elapsed = now_s() - start;
+
+    long long total = 0;
+    for (int i = 0; i < num_tas; i++) {
+        total += *views[i].ops;
+    }
+    return total / elapsed;
+}
+
+/* ---------------- main ---------------- */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t tas] [-d seconds] [-r repeats]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int num_tas = 16;
+    double seconds = 1.0;
+    int repeats = 3;
+
+    static const struct option long_opts[] = {
+        {"tas",      required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"repeats",  required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:d:r:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            num_tas = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (num_tas < 1 || num_tas > MAX_TAS || seconds <= 0 || repeats < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    PackedShared *packed = mmap(NULL, sizeof(PackedShared), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    PaddedShared *padded = mmap(NULL, sizeof(PaddedShared), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (packed == MAP_FAILED || padded == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(packed, 0, sizeof(*packed));
+    memset(padded, 0, sizeof(*padded));
+
+    sem_t *packed_sems[3] = {&packed->rubric_sem, &packed->questions_sem, &packed->exam_sem};
+    sem_t *padded_sems[3] = {&padded->rubric_sem, &padded->questions_sem, &padded->exam_sem};
+    for (int s = 0; s < 3; s++) {
+        sem_init(packed_sems[s], 1, 1);
+        sem_init(padded_sems[s], 1, 1);
+    }
+
+    TaView packed_views[MAX_TAS], padded_views[MAX_TAS];
+    for (int i = 0; i < num_tas; i++) {
+        packed_views[i] = (TaView){&packed->finished, &packed->ops[i], packed_sems[i % 3]};
+        padded_views[i] = (TaView){&padded->finished, &padded->ops[i].value, padded_sems[i % 3]};
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("Layout benchmark: %d TAs on %ld CPUs, %.1f s per run, %d repeats\n",
+           num_tas, cpus, seconds, repeats);
+    printf("  packed: %zu bytes, padded: %zu bytes\n", sizeof(PackedShared), sizeof(PaddedShared));
+
+    double best_packed = 0, best_padded = 0;
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < num_tas; i++) {
+            packed->ops[i] = 0;
+            padded->ops[i].value = 0;
+        }
+
+        double p = run_layout(packed_views, num_tas, &packed->finished, seconds);
+        double q = run_layout(padded_views, num_tas, &padded->finished, seconds);
+        printf("  run %d: packed %12.0f ops/s   padded %12.0f ops/s\n", r + 1, p, q);
+        if (p > best_packed) best_packed = p;
+        if (q > best_padded) best_padded = q;
+    }
+
+    printf("Best: packed %.0f ops/s, padded %.0f ops/s (%.2fx)\n",
+           best_packed, best_padded, best_packed > 0 ? best_padded / best_packed : 0.0);
+
+    for (int s = 0; s < 3; s++) {
+        sem_destroy(packed_sems[s]);
+        sem_destroy(padded_sems[s]);
+    }
+    munmap(packed, sizeof(PackedShared));
+    munmap(padded, sizeof(PaddedShared));
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "exams.h"
+
+// Packs every exam in an exam directory into one store file that part2b
+// can mmap (see exams.h for the layout).
+
+/* ---------------- helpers ---------------- */
+
+// Reads a whole exam file into a malloc'd buffer. Returns NULL on error.
+char *read_exam_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("fopen exam");
+        return NULL;
+    }
+
+    size_t cap = 256, used = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        used += fread(buf + used, 1, cap - used, f);
+        if (used < cap) break;
+        cap *= 2;
+        char *grown = realloc(buf, cap);
+        if (!grown) {
+            free(buf);
+            buf = NULL;
+        } else {
+            buf = grown;
+        }
+    }
+
+    fclose(f);
+    *len = used;
+    return buf;
+}
+
+/* ---------------- main ---------------- */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d exam_dir] [-o store_file]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *exam_dir = "exams";
+    const char *out_path = "exams.store";
+
+    static const struct option long_opts[] = {
+        {"exam-dir", required_argument, NULL, 'd'},
+        {"output",   required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:o:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            exam_dir = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ExamIndex index;
+    if (scan_exam_dir(exam_dir, &index) != 0) {
+        return 1;
+    }
+
+    // write to a temp file and rename, so a reader never sees half a store
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        perror("fopen store");
+        return 1;
+    }
+
+    ExamStoreHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, EXAM_STORE_MAGIC, 4);
+    hdr.version = EXAM_STORE_VERSION;
+    hdr.count = index.count;
+
+    ExamStoreEntry *entries = calloc(index.count ? index.count : 1, sizeof(*entries));
+    if (!entries) {
+        perror("calloc");
+        return 1;
+    }
+
+    // header and table first (rewritten once offsets are known), then texts
+    size_t text_off = sizeof(hdr) + index.count * sizeof(*entries);
+    if (fseek(out, (long)text_off, SEEK_SET) != 0) {
+        perror("fseek");
+        return 1;
+    }
+
+    for (int i = 0; i < index.count; i++) {
+        char path[512];
+        size_t len = 0;
+        exam_path(&index, i, path, sizeof(path));
+
+        char *text = read_exam_file(path, &len);
+        entries[i].student_id = text ? parse_exam_text(text, len) : -1;
+        entries[i].text_off = (uint32_t)text_off;
+        entries[i].text_len = (uint32_t)len;
+
+        if (len > 0 && fwrite(text, 1, len, out) != len) {
+            perror("fwrite");
+            return 1;
+        }
+        text_off += len;
+        free(text);
+    }
+
+    rewind(out);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        (index.count > 0 && fwrite(entries, sizeof(*entries), index.count, out) != (size_t)index.count)) {
+        perror("fwrite");
+        return 1;
+    }
+
+    if (fclose(out) != 0 || rename(tmp_path, out_path) != 0) {
+        perror("write store");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Packed %d exams from %s/ into %s (%zu bytes) in %.1f ms\n",
+           index.count, exam_dir, out_path, text_off,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    free(entries);
+    free_exam_index(&index);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#ifndef CONTENTION_H
+#define CONTENTION_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/* ---------------- jittered exponential backoff ---------------- */
+
+// After each failed attempt the window doubles, up to max_us, and the
+// delay is drawn uniformly from [min_us, window]. Two TAs that failed
+// together almost never retry together, which a fixed delay guarantees.
+typedef struct {
+    long min_us;
+    long max_us;
+    long window_us;                       // current upper bound
+    unsigned int seed;                    // rand_r state, per TA
+} Backoff;
+
+static inline void backoff_init(Backoff *b, long min_us, long max_us, unsigned int seed) {
+    b->min_us = min_us;
+    b->max_us = max_us;
+    b->window_us = min_us;
+    b->seed = seed;
+}
+
+// Returns the next delay and widens the window.
+static inline long backoff_next(Backoff *b) {
+    long span = b->window_us - b->min_us + 1;
+    long delay = b->min_us + (long)(rand_r(&b->seed) % span);
+    b->window_us = b->window_us * 2 > b->max_us ? b->max_us : b->window_us * 2;
+    return delay;
+}
+
+static inline void backoff_reset(Backoff *b) {
+    b->window_us = b->min_us;
+}
+
+/* ---------------- ticket arbitration ---------------- */
+
+// Tie-breaker for TAs that each hold one lock and want another's. Every
+// TA draws a ticket once and keeps it across retries, and publishes it
+// on each lock it holds. A TA that can't get its next lock looks at the
+// holder's ticket: older (lower) wins and keeps waiting, younger yields
+// (wait-die). The oldest contender therefore always gets through.
+// TAs that fell back to ordered acquisition hold with ARBITER_ORDERED,
+// which outranks every ticket, so nobody holds out against them.
+#define ARBITER_MAX_LOCKS  8
+#define ARBITER_FREE       0u             // lock not held (or holder not yet published)
+#define ARBITER_ORDERED    1u             // held by a TA acquiring in the global order
+#define ARBITER_FIRST      2u             // first real ticket
+
+// Lives in shared memory, zeroed.
+typedef struct {
+    atomic_uint next_ticket;
+    atomic_uint holder[ARBITER_MAX_LOCKS];  // ticket of each lock's holder
+} Arbiter;
+
+static inline unsigned int arbiter_ticket(Arbiter *a) {
+    return atomic_fetch_add(&a->next_ticket, 1) + ARBITER_FIRST;
+}
+
+static inline void arbiter_hold(Arbiter *a, int lock, unsigned int ticket) {
+    atomic_store(&a->holder[lock], ticket);
+}
+
+static inline void arbiter_release(Arbiter *a, int lock) {
+    atomic_store(&a->holder[lock], ARBITER_FREE);
+}
+
+// 1 if the TA with `ticket` should give up what it holds rather than
+// wait for `lock`.
+static inline int arbiter_should_yield(Arbiter *a, int lock, unsigned int ticket) {
+    unsigned int holder = atomic_load(&a->holder[lock]);
+    return holder != ARBITER_FREE && holder < ticket;
+}
+
+#endif
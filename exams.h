@@ -0,0 +1,234 @@
+#ifndef EXAMS_H
+#define EXAMS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* ---------------- exam directory index ---------------- */
+
+// Sorted list of exam files found in an exam directory. The arrays live in
+// one shared anonymous mapping made before the TAs are forked, so every TA
+// sees the same index without copying it.
+typedef struct {
+    char      dir[256];   // directory the exams were read from
+    int       count;      // number of exams
+    int32_t  *student;    // student number per exam, ascending
+    uint32_t *name_off;   // offset of each file name in names[]
+    char     *names;      // file names, NUL separated
+    size_t    map_size;   // bytes in the shared mapping
+} ExamIndex;
+
+typedef struct {
+    int32_t  student;
+    uint32_t name_off;
+} ExamScanEntry;
+
+static inline int compare_scan_entries(const void *a, const void *b) {
+    const ExamScanEntry *x = a;
+    const ExamScanEntry *y = b;
+    if (x->student != y->student) return x->student < y->student ? -1 : 1;
+    return x->name_off < y->name_off ? -1 : (x->name_off > y->name_off);
+}
+
+// Exam files are named by student number, so only all-digit names count.
+static inline int is_exam_name(const char *name) {
+    if (name[0] == '\0') return 0;
+    for (const char *p = name; *p; p++) {
+        if (*p < '0' || *p > '9') return 0;
+    }
+    return 1;
+}
+
+// Scans dir for exam files and builds a shared index sorted by student
+// number. Returns 0 on success, -1 on error.
+static inline int scan_exam_dir(const char *dir, ExamIndex *index) {
+    memset(index, 0, sizeof(*index));
+    snprintf(index->dir, sizeof(index->dir), "%s", dir);
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror("opendir exams");
+        return -1;
+    }
+
+    size_t cap = 1024, count = 0;
+    size_t names_cap = 16384, names_len = 0;
+    ExamScanEntry *entries = malloc(cap * sizeof(*entries));
+    char *names = malloc(names_cap);
+    if (!entries || !names) {
+        perror("malloc");
+        closedir(d);
+        free(entries);
+        free(names);
+        return -1;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (!is_exam_name(de->d_name)) continue;
+
+        size_t len = strlen(de->d_name) + 1;
+        if (count == cap) {
+            cap *= 2;
+            ExamScanEntry *grown = realloc(entries, cap * sizeof(*entries));
+            if (!grown) { perror("realloc"); break; }
+            entries = grown;
+        }
+        if (names_len + len > names_cap) {
+            names_cap *= 2;
+            char *grown = realloc(names, names_cap);
+            if (!grown) { perror("realloc"); break; }
+            names = grown;
+        }
+
+        memcpy(names + names_len, de->d_name, len);
+        entries[count].student = atoi(de->d_name);
+        entries[count].name_off = (uint32_t)names_len;
+        names_len += len;
+        count++;
+    }
+    closedir(d);
+
+    qsort(entries, count, sizeof(*entries), compare_scan_entries);
+
+    // one compact mapping: student[], name_off[], then the name bytes
+    size_t ints = count * sizeof(int32_t);
+    index->map_size = 2 * ints + names_len + 1;
+    void *map = mmap(NULL, index->map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap exam index");
+        free(entries);
+        free(names);
+        return -1;
+    }
+
+    index->count = (int)count;
+    index->student = map;
+    index->name_off = (uint32_t *)((char *)map + ints);
+    index->names = (char *)map + 2 * ints;
+    memcpy(index->names, names, names_len);
+    for (size_t i = 0; i < count; i++) {
+        index->student[i] = entries[i].student;
+        index->name_off[i] = entries[i].name_off;
+    }
+
+    free(entries);
+    free(names);
+    return 0;
+}
+
+// Writes the path of exam i ("dir/name") into buf.
+static inline void exam_path(const ExamIndex *index, int i, char *buf, size_t len) {
+    snprintf(buf, len, "%s/%s", index->dir, index->names + index->name_off[i]);
+}
+
+static inline void free_exam_index(ExamIndex *index) {
+    if (index->map_size > 0) {
+        munmap(index->student, index->map_size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+/* ---------------- packed exam store ---------------- */
+
+// One file holding every exam, built by build_exam_store from an exam
+// directory. Layout:
+//
+//   ExamStoreHeader
+//   ExamStoreEntry[count]   sorted by student number
+//   exam text bytes         raw file contents, entry text_off/text_len
+//
+// The student number is parsed at build time, so reading an exam from a
+// mapped store is a plain memory load.
+#define EXAM_STORE_MAGIC   "EXST"
+#define EXAM_STORE_VERSION 1
+
+typedef struct {
+    char     magic[4];     // EXAM_STORE_MAGIC
+    uint32_t version;      // EXAM_STORE_VERSION
+    uint32_t count;        // number of entries
+    uint32_t reserved;
+} ExamStoreHeader;
+
+typedef struct {
+    int32_t  student_id;   // parsed from the first line, -1 if unreadable
+    uint32_t text_off;     // offset of the raw exam text from file start
+    uint32_t text_len;     // length of the raw exam text
+    uint32_t reserved;
+} ExamStoreEntry;
+
+typedef struct {
+    const ExamStoreHeader *hdr;
+    const ExamStoreEntry  *entries;
+    size_t                 map_size;
+} ExamStore;
+
+// Parses the student number from the first line of an exam (-1 if empty).
+static inline int parse_exam_text(const char *text, size_t len) {
+    char line[64];
+    size_t n = 0;
+    while (n < len && n < sizeof(line) - 1 && text[n] != '\n' && text[n] != '\r') {
+        line[n] = text[n];
+        n++;
+    }
+    line[n] = '\0';
+    return n > 0 ? atoi(line) : -1;
+}
+
+// Maps an exam store read-only and checks its header.
+// Returns 0 on success, -1 on error.
+static inline int open_exam_store(const char *path, ExamStore *store) {
+    memset(store, 0, sizeof(*store));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open exam store");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ExamStoreHeader)) {
+        fprintf(stderr, "%s: not an exam store\n", path);
+        close(fd);
+        return -1;
+    }
+
+    // MAP_POPULATE faults the whole store in now, not on exam transitions
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap exam store");
+        return -1;
+    }
+
+    const ExamStoreHeader *hdr = map;
+    size_t table_end = sizeof(*hdr) + (size_t)hdr->count * sizeof(ExamStoreEntry);
+    if (memcmp(hdr->magic, EXAM_STORE_MAGIC, 4) != 0 ||
+        hdr->version != EXAM_STORE_VERSION || table_end > (size_t)st.st_size) {
+        fprintf(stderr, "%s: bad exam store header\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    store->hdr = hdr;
+    store->entries = (const ExamStoreEntry *)(hdr + 1);
+    store->map_size = st.st_size;
+    return 0;
+}
+
+static inline void close_exam_store(ExamStore *store) {
+    if (store->hdr) {
+        munmap((void *)store->hdr, store->map_size);
+    }
+    memset(store, 0, sizeof(*store));
+}
+
+#endif
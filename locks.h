@@ -0,0 +1,336 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+/* ---------------- shared lock table ---------------- */
+
+// Named process-shared mutexes in shared memory, plus a record of who
+// holds each one and which lock each owner (TA) is blocked on. Together
+// these form the wait-for graph: owner -> lock it waits for -> that
+// lock's holder.
+//
+// The mutexes are robust: if a process dies holding one, the next owner
+// gets it back (EOWNERDEAD), marks it consistent and carries on instead
+// of everyone hanging. Each lock counts how often that happened.
+//
+// With detection on, a waiter uses a timed lock and, every LOCK_CHECK_MS
+// it stays blocked, walks the graph from itself. If the walk comes back
+// round, the owners on it are deadlocked. The one that started waiting
+// last is the victim: its acquire fails with LOCK_DEADLOCK, and the caller
+// releases what it holds and retries. Only the victim backs off, so the
+// rest of the cycle keeps its place.
+//
+// Code that needs several locks at once should take them as a set
+// (lock_acquire_set): the set is always taken in index order, the one
+// global order, so sets can never form a cycle and need no timeouts.
+// Built with -DLOCK_DEBUG, any acquire that takes a lock while holding
+// one with a higher index aborts with both names.
+#define LOCK_MAX         8    // locks in one table
+#define LOCK_MAX_OWNERS  64   // owners (TAs) that can wait with detection on
+#define LOCK_CHECK_MS    20   // how often a blocked waiter looks for a cycle
+
+#define LOCK_OK          0
+#define LOCK_DEADLOCK    (-1) // caller was picked as the victim of a cycle
+
+// A line each, so TAs taking different locks don't share one.
+typedef struct __attribute__((aligned(64))) {
+    pthread_mutex_t mutex;                // robust, process-shared
+    int   holder;                         // owner holding it, -1 = free
+    int   owner_deaths;                   // times taken over from a dead holder
+    char  name[16];
+} SharedLock;
+
+// Bit i = lock i of a table; see lock_acquire_set.
+typedef unsigned int LockSet;
+#define LOCK_BIT(i)      (1u << (i))
+
+// Lives in shared memory; the graph fields are only touched under graph_mutex.
+typedef struct {
+    int        detect;                    // 0 = plain blocking lock, as before
+    int        num_owners;
+    int        num_locks;
+    SharedLock locks[LOCK_MAX];
+    int        waiting_for[LOCK_MAX_OWNERS];   // lock each owner is blocked on, -1 = none
+    long long  wait_start_us[LOCK_MAX_OWNERS]; // when it started waiting
+    pthread_mutex_t graph_mutex;          // protects holders, waiting_for and the stats
+
+    // recovery stats
+    int        checks;                    // timed waits that expired and scanned the graph
+    int        recoveries;                // cycles broken by backing a victim off
+    long long  detect_us_total;           // cycle formed -> victim told, summed
+    long long  detect_us_max;
+} LockTable;
+
+static inline long long lock_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Process-shared robust mutex for a lock table.
+static inline int lock_mutex_init(pthread_mutex_t *m) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int rc = pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return rc;
+}
+
+// Finishes a lock call: if the last holder died, the mutex is ours but
+// flagged EOWNERDEAD; mark it consistent so it keeps working. Returns 0
+// once the mutex is held, otherwise the error. *deaths counts takeovers.
+static inline int lock_mutex_result(pthread_mutex_t *m, int rc, int *deaths) {
+    if (rc == EOWNERDEAD) {
+        pthread_mutex_consistent(m);
+        (*deaths)++;
+        return 0;
+    }
+    return rc;
+}
+
+static inline void lock_graph(LockTable *t) {
+    int deaths = 0;
+    lock_mutex_result(&t->graph_mutex, pthread_mutex_lock(&t->graph_mutex), &deaths);
+}
+
+static inline void unlock_graph(LockTable *t) {
+    pthread_mutex_unlock(&t->graph_mutex);
+}
+
+// Initializes an empty table in shared memory. Returns 0 on success.
+// Owners are numbered from 0; without detection there is no limit.
+static inline int lock_table_init(LockTable *t, int num_owners, int detect) {
+    if (detect && num_owners > LOCK_MAX_OWNERS) {
+        fprintf(stderr, "lock table: at most %d owners\n", LOCK_MAX_OWNERS);
+        return -1;
+    }
+    memset(t, 0, sizeof(*t));
+    t->detect = detect;
+    t->num_owners = num_owners;
+    for (int i = 0; i < LOCK_MAX_OWNERS; i++) {
+        t->waiting_for[i] = -1;
+    }
+    return lock_mutex_init(&t->graph_mutex);
+}
+
+// Adds a free lock. Returns its index, or -1 if the table is full.
+static inline int lock_add(LockTable *t, const char *name) {
+    if (t->num_locks == LOCK_MAX) {
+        return -1;
+    }
+    SharedLock *l = &t->locks[t->num_locks];
+    if (lock_mutex_init(&l->mutex) != 0) {
+        return -1;
+    }
+    l->holder = -1;
+    snprintf(l->name, sizeof(l->name), "%s", name);
+    return t->num_locks++;
+}
+
+static inline void lock_table_destroy(LockTable *t) {
+    for (int i = 0; i < t->num_locks; i++) {
+        pthread_mutex_destroy(&t->locks[i].mutex);
+    }
+    pthread_mutex_destroy(&t->graph_mutex);
+}
+
+/* ---------------- deadlock detection ---------------- */
+
+// Follows the wait-for chain from `start`. Each owner waits for at most
+// one lock and each lock has at most one holder, so the chain is a simple
+// path; if it leads back to start, returns the cycle member that started
+// waiting last (ties: highest owner). Returns -1 if there is no cycle
+// through start. Caller holds graph_mutex.
+static inline int lock_find_victim(LockTable *t, int start) {
+    int victim = start;
+    int o = start;
+    for (int steps = 0; steps < t->num_owners; steps++) {
+        int lock = t->waiting_for[o];
+        if (lock < 0) return -1;
+        int h = t->locks[lock].holder;
+        if (h < 0) return -1;
+        if (h == start) return victim;
+
+        if (t->wait_start_us[h] > t->wait_start_us[victim] ||
+            (t->wait_start_us[h] == t->wait_start_us[victim] && h > victim)) {
+            victim = h;
+        }
+        o = h;
+    }
+    return -1; // blocked behind a cycle that doesn't include start
+}
+
+/* ---------------- acquire / release ---------------- */
+
+#ifdef LOCK_DEBUG
+// Aborts if owner already holds a lock that comes after `lock`.
+static inline void lock_check_order(LockTable *t, int lock, int owner) {
+    for (int i = lock + 1; i < t->num_locks; i++) {
+        if (t->locks[i].holder == owner) {
+            fprintf(stderr, "lock order violation: owner %d takes %s while holding %s\n",
+                    owner, t->locks[lock].name, t->locks[i].name);
+            abort();
+        }
+    }
+}
+#else
+static inline void lock_check_order(LockTable *t, int lock, int owner) {
+    (void)t; (void)lock; (void)owner;
+}
+#endif
+
+// Takes `lock` for `owner`. Returns LOCK_OK, or LOCK_DEADLOCK if the owner
+// was chosen to break a cycle; it then still holds its other locks and
+// must release them before retrying.
+static inline int lock_acquire(LockTable *t, int lock, int owner) {
+    SharedLock *l = &t->locks[lock];
+    lock_check_order(t, lock, owner);
+
+    if (!t->detect) {
+        lock_mutex_result(&l->mutex, pthread_mutex_lock(&l->mutex), &l->owner_deaths);
+        l->holder = owner;
+        return LOCK_OK;
+    }
+
+    lock_graph(t);
+    t->waiting_for[owner] = lock;
+    t->wait_start_us[owner] = lock_now_us();
+    unlock_graph(t);
+
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOCK_CHECK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        int rc = pthread_mutex_timedlock(&l->mutex, &deadline);
+        if (lock_mutex_result(&l->mutex, rc, &l->owner_deaths) == 0) {
+            break;
+        }
+
+        // still blocked: is this owner the victim of a wait-for cycle?
+        lock_graph(t);
+        t->checks++;
+        if (lock_find_victim(t, owner) == owner) {
+            // the victim started waiting last, so the cycle formed then
+            long long latency = lock_now_us() - t->wait_start_us[owner];
+            t->waiting_for[owner] = -1;
+            t->recoveries++;
+            t->detect_us_total += latency;
+            if (latency > t->detect_us_max) {
+                t->detect_us_max = latency;
+            }
+            unlock_graph(t);
+            return LOCK_DEADLOCK;
+        }
+        unlock_graph(t);
+    }
+
+    lock_graph(t);
+    t->waiting_for[owner] = -1;
+    l->holder = owner;
+    unlock_graph(t);
+    return LOCK_OK;
+}
+
+// The holder is cleared before the unlock, so the graph never names an
+// owner that has already let go.
+static inline void lock_release(LockTable *t, int lock) {
+    SharedLock *l = &t->locks[lock];
+    if (t->detect) {
+        lock_graph(t);
+        l->holder = -1;
+        unlock_graph(t);
+    } else {
+        l->holder = -1;
+    }
+    pthread_mutex_unlock(&l->mutex);
+}
+
+// Total takeovers from dead holders across the table.
+static inline int lock_owner_deaths(LockTable *t) {
+    int deaths = 0;
+    for (int i = 0; i < t->num_locks; i++) {
+        deaths += t->locks[i].owner_deaths;
+    }
+    return deaths;
+}
+
+// Releases every lock `owner` holds (a victim backing off).
+static inline void lock_release_all(LockTable *t, int owner) {
+    for (int i = 0; i < t->num_locks; i++) {
+        if (t->locks[i].holder == owner) {
+            lock_release(t, i);
+        }
+    }
+}
+
+// Takes `lock` only if it is free. Returns LOCK_OK or -1.
+static inline int lock_try_acquire(LockTable *t, int lock, int owner) {
+    SharedLock *l = &t->locks[lock];
+    lock_check_order(t, lock, owner);
+    if (lock_mutex_result(&l->mutex, pthread_mutex_trylock(&l->mutex), &l->owner_deaths) != 0) {
+        return -1;
+    }
+    if (t->detect) {
+        lock_graph(t);
+        t->locks[lock].holder = owner;
+        unlock_graph(t);
+    } else {
+        t->locks[lock].holder = owner;
+    }
+    return LOCK_OK;
+}
+
+/* ---------------- acquire sets ---------------- */
+
+// Takes every lock in `set`, lowest index first. Returns LOCK_OK, or
+// LOCK_DEADLOCK (holding none of the set) if a member was picked as a
+// victim; that needs another path that takes locks out of order.
+static inline int lock_acquire_set(LockTable *t, LockSet set, int owner) {
+    for (int i = 0; i < t->num_locks; i++) {
+        if (!(set & LOCK_BIT(i))) continue;
+        if (lock_acquire(t, i, owner) == LOCK_DEADLOCK) {
+            for (int j = 0; j < i; j++) {
+                if (set & LOCK_BIT(j)) lock_release(t, j);
+            }
+            return LOCK_DEADLOCK;
+        }
+    }
+    return LOCK_OK;
+}
+
+// Takes the whole set only if every member is free right now.
+// Returns LOCK_OK, or -1 holding none of it.
+static inline int lock_try_acquire_set(LockTable *t, LockSet set, int owner) {
+    for (int i = 0; i < t->num_locks; i++) {
+        if (!(set & LOCK_BIT(i))) continue;
+        if (lock_try_acquire(t, i, owner) != LOCK_OK) {
+            for (int j = 0; j < i; j++) {
+                if (set & LOCK_BIT(j)) lock_release(t, j);
+            }
+            return -1;
+        }
+    }
+    return LOCK_OK;
+}
+
+// Releases the set, highest index first.
+static inline void lock_release_set(LockTable *t, LockSet set) {
+    for (int i = t->num_locks - 1; i >= 0; i--) {
+        if (set & LOCK_BIT(i)) lock_release(t, i);
+    }
+}
+
+#endif
@@ -5,15 +5,18 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <getopt.h>
 #include <time.h>
 
+#include "exams.h"
+
 #define MAX_RUBRIC_LINES 5
 #define MAX_QUESTIONS    5
 
 typedef struct {
     char rubric[MAX_RUBRIC_LINES][20];   // rubric lines: "1,A" etc.
     int  questions_marked[MAX_QUESTIONS]; // 0 = not marked, 1 = marked
-    int  current_exam_index;             // index into exam_files[]
+    int  current_exam_index;             // index into exam_list
     int  student_id;                     // current student number
     int  finished;                       // 1 when TAs should stop
 } SharedData;
@@ -23,16 +26,9 @@ int random_delay(int min_ms, int max_ms) {
     return (rand() % (max_ms - min_ms + 1) + min_ms) * 1000;
 }
 
-/* -------------------- exam file list -------------------- */
-/* matches the files in exams/ */
-const char *exam_files[] = {
-    "exams/0001", "exams/0002","exams/0003","exams/0004","exams/0005","exams/0010","exams/0015",
-    "exams/0020","exams/0025","exams/0030","exams/0100","exams/0200","exams/0300","exams/0500",
-    "exams/1000","exams/1500","exams/2000","exams/3000","exams/5000","exams/7000","exams/8000",
-    "exams/8500","exams/9000","exams/9500",
-    "exams/9999"      // stop exam
-};
-const int NUM_EXAMS = sizeof(exam_files) / sizeof(exam_files[0]);
+/* -------------------- exam list -------------------- */
+/* scanned from the exam directory in main, before forking */
+ExamIndex exam_list;
 
 /* -------------------- rubric helpers -------------------- */
 
@@ -188,7 +184,7 @@ void ta_process(int ta_id, SharedData *data) {
 
             // move to the next exam (race condition possible!)
             int next_idx = data->current_exam_index + 1;
-            if (next_idx >= NUM_EXAMS) {
+            if (next_idx >= exam_list.count) {
                 data->finished = 1;
                 break;
             }
@@ -196,8 +192,10 @@ void ta_process(int ta_id, SharedData *data) {
             data->current_exam_index = next_idx;
 
             // Safety check before array access
-            if (data->current_exam_index < NUM_EXAMS) {
-                load_exam(data, exam_files[data->current_exam_index]);
+            if (data->current_exam_index < exam_list.count) {
+                char path[512];
+                exam_path(&exam_list, data->current_exam_index, path, sizeof(path));
+                load_exam(data, path);
                 printf("TA %d: Moving to next exam (student %d)\n",
                        ta_id, data->student_id);
                 fflush(stdout);
@@ -214,13 +212,36 @@ void ta_process(int ta_id, SharedData *data) {
 
 /* -------------------- main -------------------- */
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d exam_dir] <number_of_TAs>\n", prog);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <number_of_TAs>\n", argv[0]);
+    const char *exam_dir = "exams";
+
+    static const struct option long_opts[] = {
+        {"exam-dir", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            exam_dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(argv[0]);
         return 1;
     }
 
-    int num_tas = atoi(argv[1]);
+    int num_tas = atoi(argv[optind]);
     if (num_tas < 2) {
         fprintf(stderr, "Number of TAs must be at least 2\n");
         return 1;
@@ -250,8 +271,22 @@ int main(int argc, char *argv[]) {
     }
     fflush(stdout);
 
+    // index the exam directory (sorted by student number)
+    struct timespec scan_start, scan_end;
+    clock_gettime(CLOCK_MONOTONIC, &scan_start);
+    if (scan_exam_dir(exam_dir, &exam_list) != 0 || exam_list.count == 0) {
+        fprintf(stderr, "No exams found in %s/\n", exam_dir);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &scan_end);
+    printf("Indexed %d exams from %s/ in %.1f ms\n", exam_list.count, exam_dir,
+           (scan_end.tv_sec - scan_start.tv_sec) * 1e3 +
+           (scan_end.tv_nsec - scan_start.tv_nsec) / 1e6);
+
     // load the first exam from file into shared memory
-    load_exam(data, exam_files[data->current_exam_index]);
+    char path[512];
+    exam_path(&exam_list, data->current_exam_index, path, sizeof(path));
+    load_exam(data, path);
     printf("First exam loaded: student %d\n", data->student_id);
     fflush(stdout);
 
@@ -285,6 +320,7 @@ int main(int argc, char *argv[]) {
     }
 
     munmap(data, sizeof(SharedData));
+    free_exam_index(&exam_list);
     free(pids);
     return 0;
 }
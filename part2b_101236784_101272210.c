@@ -1,329 +1,3016 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <time.h>
+#include <signal.h>
 
-#define MAX_RUBRIC_LINES 5
-#define MAX_QUESTIONS    5
+#include "exams.h"
+#include "locks.h"
 
+#define MAX_RUBRIC_LINES 4096 // most rubric lines read from the rubric file
+#define MAX_QUESTIONS    4096 // most questions per exam (--questions)
+#define DEFAULT_QUESTIONS 5
+#define FAST_QUESTIONS   64   // up to this many, claims use one inline word per slot
+#define MAX_EXAM_SLOTS   64  // most exams that can be in flight (--in-flight)
+#define LOADER_QUEUE     8   // exams the loader keeps parsed ahead of the TAs
+#define RUBRIC_FLUSH_MS  500 // write-behind flush interval
+#define RUBRIC_RETRIES   3   // re-reads allowed after an edit conflict
+#define LOG_RING_SIZE    128 // per-TA event log ring capacity (power of two)
+#define CACHE_LINE       64  // bytes; hot shared fields get a line each
+#define MARK_MIN_MS      1000 // marking one question takes 1-2 s, scaled by --delay-scale
+#define MARK_MAX_MS      2000
+#define LEASE_MS         5000 // a claim's lease, scaled by --delay-scale (--lease-ms)
+#define SUPERVISE_MS     20   // how often the fork-mode supervisor checks on TAs
+#define CHECKPOINT_MS    1000 // how often a --state file is synced to disk
+#define STATE_MAGIC      "TASTATE"
+#define STATE_VERSION    3
+#define HIST_SUB_BITS    4   // histogram buckets per power of two = 2^4 (~6% error)
+#define HIST_BUCKETS     ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+#define CACHE_ALIGNED    __attribute__((aligned(CACHE_LINE)))
+
+// Locks in data->locks, in the global order they are always taken in.
+enum { RUBRIC_LOCK, EXAM_LOCK };
+
+// One in-flight exam. TAs can mark any slot, so idle TAs move on to the
+// next exam while others are still finishing the current one.
+// Question state is bitmasks (bit q = question q + 1) updated with atomic
+// fetch-or, so claiming needs no semaphore. Exams of up to FAST_QUESTIONS
+// questions use the two words here; wider exams keep their claim and done
+// words in the variable part of the shared region.
+// Each slot has its own cache line, so claims on one exam don't slow
+// TAs working on another.
+typedef struct CACHE_ALIGNED {
+    atomic_int    exam_index;             // index into exam_list, -1 = slot empty
+    int           student_id;             // student number for this exam
+    atomic_ullong claimed;                // questions reserved by a TA (fast path)
+    atomic_ullong done;                   // questions finished marking (fast path)
+    long long     loaded_us;              // when the exam was loaded (latency start)
+} ExamSlot;
+
+// Lease on one question: who is marking it and until when. A claim bit
+// or task only says where to look; taking the lease (a compare-and-swap
+// from 0) is what makes the question the TA's, so a stale claim or a
+// duplicate task is harmless. The supervisor takes back leases of dead
+// TAs and expired ones, and a TA whose lease was taken drops its mark.
+// A TA completing its mark flips ta to -id first, so the lease can no
+// longer be taken back, and frees it once `done` and the slot's done
+// mask are set; if it dies in between, the supervisor finishes the job.
+// --resume rebuilds the claim state of every in-flight exam from `done`.
+typedef struct {
+    atomic_int   ta;                      // TA id marking it, -id = completing, 0 = free
+    atomic_int   done;                    // 1 once the question is marked
+    atomic_llong deadline_us;             // now_us() after which it may be reclaimed
+} Lease;
+
+// One rubric line. seq doubles as the line's version: readers copy the
+// text and retry if seq moved (odd = write in progress), and a writer
+// only gets in by compare-and-swapping the exact version it reviewed.
+// Lines are rubric_len bytes long, sized from the rubric file, and each
+// starts on its own cache line (rubric_stride).
+typedef struct {
+    atomic_uint seq;                      // even = stable version, odd = being written
+    char  text[];                         // rubric line like "1,A"
+} RubricLine;
+
+// How a TA picks which free question to claim (--policy).
+typedef enum {
+    POLICY_FIRST_FREE,   // lowest-numbered free question
+    POLICY_RANDOM,       // uniformly random free question
+    POLICY_ROUND_ROBIN,  // rotate through question numbers, offset by TA id
+    POLICY_SHORTEST,     // free question with the lowest average marking time
+    POLICY_AFFINITY,     // same question number as last time, if free
+    POLICY_STEAL,        // per-TA task deques, idle TAs steal from busy ones
+} Policy;
+
+const char *policy_names[] = {
+    "first-free", "random", "round-robin", "shortest", "affinity", "steal"
+};
+#define NUM_POLICIES ((int)(sizeof(policy_names) / sizeof(policy_names[0])))
+
+// PCG32 random number generator: 64-bit state, 32-bit output. Each TA has
+// its own, seeded from --seed, so runs can be repeated exactly.
+typedef struct {
+    uint64_t state;
+    uint64_t inc;                         // stream selector, always odd
+} Pcg32;
+
+// Where a TA is in its loop. Each phase ends where the original loop
+// slept, so a TA can be driven by usleep (one process or thread per TA)
+// or multiplexed with other TAs on one thread.
+typedef enum {
+    TA_START,            // top of the loop: stop or start a rubric review
+    TA_REVIEW_LINE,      // read the next rubric line, then review it for a while
+    TA_REVIEW_DONE,      // maybe fix the line just reviewed
+    TA_FIND_WORK,        // claim a question
+    TA_MARK_DONE,        // question marked: complete it, maybe load the next exam
+    TA_STOPPED,
+} TaPhase;
+
+// Private state of one TA.
+typedef struct {
+    int id;                               // TA number, 1-based
+    TaPhase phase;
+    Pcg32 rng;                            // this TA's random numbers
+
+    // scheduling policy state
+    int last_question;                    // question marked last time, -1 = none
+    int rr_next;                          // round-robin cursor
+    int crashable;                        // a fork-mode TA process: --crash may kill it
+
+    // rubric review in progress
+    int line;                             // rubric line being reviewed
+    unsigned int version;                 // version of that line when read
+    char *text;                           // copy of that line (rubric_len bytes)
+    long long review_start;
+
+    unsigned int work_seq;                // data->work_seq when last looking for work
+
+    // question being marked
+    ExamSlot *slot;
+    int question;
+    int student_id;
+    long long mark_start;
+} TaState;
+
+// Per-TA timing, one entry per TA in its own shared mapping. Padded to a
+// cache line so TAs updating their own stats don't share lines.
+typedef struct CACHE_ALIGNED {
+    int       questions;                  // questions marked
+    long long review_us;                  // time spent reviewing the rubric
+    long long mark_us;                    // time spent marking
+    long long rubric_wait_us;             // time blocked on the rubric lock
+    long long exam_wait_us;               // time blocked on the exam lock
+    int       claim_retries;              // question claims lost to another TA
+    int       work_waits;                 // times it slept with no question free
+    int       respawns;                   // times the supervisor restarted it
+} TaStats;
+
+// HDR-style latency histogram: log-linear buckets, 2^HIST_SUB_BITS per
+// power of two, so any recorded value is within ~6% of its bucket.
+// Updated with atomics from any TA; lives in SharedData.
+typedef struct CACHE_ALIGNED {
+    atomic_llong count;
+    atomic_llong sum_us;
+    atomic_llong max_us;
+    atomic_llong buckets[HIST_BUCKETS];
+} Histogram;
+
+// Chase-Lev work-stealing deque of (exam slot, question) tasks, one per TA.
+// The owner pushes and pops at the bottom; other TAs steal from the top.
+// Holds deque_size tasks, at least exam_slots * num_questions, so it never
+// fills; deques are deque_stride bytes apart in their mapping.
+// top is written by thieves and bottom by the owner, so they sit on
+// separate cache lines.
+typedef struct {
+    CACHE_ALIGNED atomic_llong top;       // next task to steal
+    CACHE_ALIGNED atomic_llong bottom;    // next free entry (owner only)
+
+    // owner-written counters, read by main at shutdown
+    int seeded;                           // tasks pushed into this deque
+    int steals;                           // tasks taken from other TAs
+    int steal_misses;                     // steal attempts that found nothing
+
+    atomic_int tasks[];                   // task = slot * num_questions + question
+} TaskDeque;
+
+// Things a TA logs. Each becomes one fixed-size LogRecord.
+typedef enum {
+    EV_STARTED,
+    EV_REVIEW_START,
+    EV_RUBRIC_MODIFIED,   // arg = rubric line, old_char -> new_char
+    EV_REVIEW_DONE,
+    EV_MARK_START,        // arg = question, student
+    EV_MARK_DONE,         // arg = question, student
+    EV_EXAM_DONE,         // student
+    EV_STOP_EXAM,         // student 9999 marked
+    EV_NEXT_EXAM,         // student loaded into the freed slot
+    EV_STOPPED,
+} EventType;
+
+// One binary log event (24 bytes, also the --log-binary file format).
+typedef struct {
+    int64_t time_us;      // now_us(): simulated clock under --virtual
+    int32_t ta;           // TA id
+    int32_t student;      // student number, -1 if none
+    int16_t type;         // EventType
+    int16_t arg;          // question or rubric line, 1-based
+    char    old_char;     // EV_RUBRIC_MODIFIED only
+    char    new_char;
+    char    pad[2];
+} LogRecord;
+
+// --log-binary file: this header, then LogRecords in time order.
+#define LOG_FILE_MAGIC   "TALG"
+#define LOG_FILE_VERSION 1
+
+typedef struct {
+    char     magic[4];     // LOG_FILE_MAGIC
+    uint32_t version;      // LOG_FILE_VERSION
+    uint32_t record_size;  // sizeof(LogRecord)
+    uint32_t reserved;
+} LogFileHeader;
+
+// Single-producer / single-consumer ring: the TA appends, the log writer
+// process drains. No locks and no syscalls on the TA side.
+// head and tail are on separate cache lines (producer vs consumer).
 typedef struct {
-    char rubric[MAX_RUBRIC_LINES][20];    // rubric lines like "1,A"
-    int  questions_marked[MAX_QUESTIONS]; // 0 = not marked, 1 = marked
-    int  current_exam_index;              // index into exam_files[]
-    int  student_id;                      // current student number
-    int  finished;                        // 1 when everyone should stop
-
-    // semaphores shared between processes
-    sem_t rubric_sem;     // protects rubric updates + rubric file
-    sem_t questions_sem;  // protects questions_marked[]
-    sem_t exam_sem;       // protects exam transitions (loading next exam / finished)
+    CACHE_ALIGNED atomic_uint head;       // next record the TA writes
+    CACHE_ALIGNED atomic_uint tail;       // next record the writer reads
+    CACHE_ALIGNED LogRecord records[LOG_RING_SIZE];
+} LogRing;
+
+// An exam the loader process has already read and parsed.
+typedef struct {
+    int exam_index;                       // index into exam_list, -1 = no more exams
+    int student_id;
+} LoadedExam;
+
+// Fixed header of the shared region. It is followed by parts whose size
+// depends on the rubric file and --questions, found through the offsets.
+// With --state the whole region is a file, and magic/version/header_size
+// identify it when a later run resumes from it:
+//
+//   SharedData
+//   RubricLine[rubric_lines]              rubric_stride bytes each
+//   atomic_ullong[slots][2][mask_words]   claim then done words (wide exams only), claim_stride apart
+//   Lease[slots][num_questions]           one lease per question
+//   atomic_llong[num_questions]           marking time per question
+//   atomic_int[num_questions]             marks per question
+//
+// Fields are grouped by who writes them, and every group that changes
+// while TAs run starts on its own cache line: polling `finished` or
+// taking the exam lock never pulls in a line another TA is writing.
+typedef struct {
+    // read-only after setup: shape of the region, set once by main
+    char   magic[8];                      // STATE_MAGIC once setup is complete
+    int    version;                       // STATE_VERSION
+    int    header_size;                   // sizeof(SharedData) of the writer
+    int    num_questions;                 // --questions
+    int    exam_slots;                    // --in-flight
+    int    num_exams;                     // exams indexed at the start of the run
+    int    rubric_lines;                  // lines in the rubric file
+    int    rubric_len;                    // bytes of text per line, NUL included
+    size_t rubric_stride;                 // bytes per RubricLine
+    int    mask_words;                    // 64-bit claim words per exam
+    size_t claim_stride;                  // bytes per exam's claim and done words
+    size_t rubric_off;                    // offsets from the start of the region
+    size_t claimed_off;
+    size_t leases_off;
+    size_t question_us_off;
+    size_t question_marks_off;
+    size_t map_size;                      // bytes in the whole region
+
+    // read-mostly: polled by every TA, written once
+    CACHE_ALIGNED int finished;           // 1 when everyone should stop
+    int  tas_exited;                      // 1 once main has reaped every TA
+    long long start_us;                   // when the TAs were started
+
+    ExamSlot exams[MAX_EXAM_SLOTS];       // exams being marked, a line each
+
+    // exam transition state, written under the exam lock only
+    CACHE_ALIGNED int stop_loading;       // 1 once the 9999 exam is loaded
+    atomic_int loader_head;               // queue entries taken so far
+    int  transitions;                     // exams taken from the queue
+    int  loader_stalls;                   // transitions that found the queue empty
+    long long loader_stall_us;            // time TAs spent waiting on the loader
+    int  resume_exam;                     // first exam not yet taken into a slot
+
+    // bounded queue filled by the loader process, drained under the exam lock
+    CACHE_ALIGNED LoadedExam loader_queue[LOADER_QUEUE];
+    CACHE_ALIGNED int next_exam_index;    // next exam_list entry to load (loader only)
+    atomic_int loader_tail;               // queue entries filled so far (loader only)
+
+    // write-heavy counters any TA may bump
+    CACHE_ALIGNED atomic_uint rubric_edits; // bumped on every rubric edit (write-behind)
+    atomic_int edit_attempts;             // compare-and-swap edits tried
+    atomic_int edit_conflicts;            // line changed since it was reviewed
+    atomic_int edit_dropped;              // gave up after RUBRIC_RETRIES re-reads
+    atomic_int log_rings_full;            // times a TA waited on a full log ring
+
+    // idle TAs sleep on work_seq (a futex word) until new work is published
+    CACHE_ALIGNED atomic_uint work_seq;   // bumped when an exam is loaded or the run ends
+    atomic_int work_waiters;              // TAs (or event loops) asleep on work_seq
+    atomic_int work_wakes;                // futex wakeups sent
+
+    // lease outcomes
+    CACHE_ALIGNED atomic_int leases_dead; // claims taken back from dead TAs (supervisor)
+    atomic_int leases_expired;            // claims taken back after the deadline (supervisor)
+    atomic_int leases_lost;               // marks dropped because the lease was gone (TAs)
+    int  respawns;                        // TAs restarted (supervisor only)
+
+    CACHE_ALIGNED int rubric_flushes;     // rubric.txt rewrites (flusher only)
+    int  checkpoints;                     // --state syncs (checkpointer only)
+    long long checkpoint_us_max;          // longest sync
+    int  resumes;                         // runs that continued from this state
+
+    // latency histograms (microseconds), each cache-line aligned
+    Histogram exam_latency;               // exam loaded -> all questions marked
+    Histogram rubric_wait;                // each rubric lock acquisition
+    Histogram exam_wait;                  // each exam lock acquisition
+
+    // RUBRIC_LOCK protects rubric.txt writes (lines take no lock: each
+    // is edited by a CAS on its seq version and read optimistically),
+    // EXAM_LOCK exam transitions (loading next exam / finished); a line each
+    CACHE_ALIGNED LockTable locks;
+
+    // semaphores shared between processes, a line each; loader_head and
+    // loader_tail say what is in the queue, these only wake its sleepers
+    CACHE_ALIGNED sem_t loader_free;      // posted when an entry is taken
+    CACHE_ALIGNED sem_t loader_ready;     // posted when an entry is filled
 } SharedData;
 
+// monotonic clock in microseconds
+long long wall_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Virtual-time mode (--virtual): delays advance a simulated clock that
+// the event loop moves forward, instead of sleeping.
+int virtual_time = 0;
+long long virtual_now = 0;
+
+// simulation clock in microseconds: real time, or the simulated clock
+long long now_us(void) {
+    return virtual_time ? virtual_now : wall_us();
+}
+
+// Base seed for every TA's generator (--seed, default: time of day).
+uint64_t run_seed = 0;
+
+uint32_t pcg32_next(Pcg32 *rng) {
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Seeds a generator; different streams give unrelated sequences even
+// for the same seed.
+void pcg32_seed(Pcg32 *rng, uint64_t seed, uint64_t stream) {
+    rng->state = 0;
+    rng->inc = (stream << 1) | 1;
+    pcg32_next(rng);
+    rng->state += seed;
+    pcg32_next(rng);
+}
+
+// per-TA random number in [0, n)
+int ta_rand(TaState *ta, int n) {
+    return (int)(((uint64_t)pcg32_next(&ta->rng) * (uint32_t)n) >> 32);
+}
+
+// Multiplies every TA delay (--delay-scale), e.g. 0.01 for benchmarks.
+double delay_scale = 1.0;
+
+long scaled_delay(long us) {
+    return (long)(us * delay_scale);
+}
+
 // random delay in microseconds between min_ms and max_ms (ms)
-int random_delay(int min_ms, int max_ms) {
-    return (rand() % (max_ms - min_ms + 1) + min_ms) * 1000;
+int random_delay(TaState *ta, int min_ms, int max_ms) {
+    return (int)scaled_delay((ta_rand(ta, max_ms - min_ms + 1) + min_ms) * 1000L);
+}
+
+/* ---------------- metrics ---------------- */
+
+// Bucket for a value: values below 2^HIST_SUB_BITS get their own bucket,
+// larger ones keep the top HIST_SUB_BITS bits after the leading one.
+int hist_bucket(long long v) {
+    if (v < (1 << HIST_SUB_BITS)) {
+        return v < 0 ? 0 : (int)v;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long)v);
+    int shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// Highest value that lands in a bucket.
+long long hist_bucket_max(int b) {
+    if (b < (1 << HIST_SUB_BITS)) {
+        return b;
+    }
+    int shift = (b >> HIST_SUB_BITS) - 1;
+    long long base = (long long)((1 << HIST_SUB_BITS) + (b & ((1 << HIST_SUB_BITS) - 1))) << shift;
+    return base + (1LL << shift) - 1;
+}
+
+void hist_record(Histogram *h, long long v) {
+    atomic_fetch_add_explicit(&h->buckets[hist_bucket(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_us, v, memory_order_relaxed);
+
+    long long max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (v > max && !atomic_compare_exchange_weak(&h->max_us, &max, v)) {
+    }
+}
+
+// Value at percentile p (0-100), reported as its bucket's upper bound.
+long long hist_percentile(Histogram *h, double p) {
+    long long count = atomic_load(&h->count);
+    if (count == 0) {
+        return 0;
+    }
+
+    long long rank = (long long)(p / 100.0 * count + 0.5);
+    if (rank < 1) rank = 1;
+
+    long long seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += atomic_load(&h->buckets[b]);
+        if (seen >= rank) {
+            long long v = hist_bucket_max(b);
+            long long max = atomic_load(&h->max_us);
+            return v < max ? v : max;
+        }
+    }
+    return atomic_load(&h->max_us);
+}
+
+// Takes a set of data->locks for a TA and records how long it blocked:
+// into *total_us and h. The uncontended case costs no clock reads.
+void timed_lock(SharedData *data, LockSet set, int ta_id, long long *total_us, Histogram *h) {
+    if (lock_try_acquire_set(&data->locks, set, ta_id - 1) == LOCK_OK) {
+        hist_record(h, 0);
+        return;
+    }
+
+    long long start = now_us();
+    lock_acquire_set(&data->locks, set, ta_id - 1);
+    long long waited = now_us() - start;
+    *total_us += waited;
+    hist_record(h, waited);
+}
+
+/* ---------------- work wait/notify ---------------- */
+
+// Idle TAs block on data->work_seq instead of polling. Whatever gives TAs
+// new work bumps it and wakes the sleepers. A TA reads it before looking
+// for work, so a bump that lands in between makes its wait return at once.
+
+long futex(atomic_uint *word, int op, unsigned int val, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+// Blocks until work_seq moves past seq, or for at most timeout_us
+// (-1 = no limit).
+void wait_for_work(SharedData *data, unsigned int seq, long timeout_us) {
+    struct timespec ts, *timeout = NULL;
+    if (timeout_us >= 0) {
+        ts.tv_sec = timeout_us / 1000000;
+        ts.tv_nsec = (timeout_us % 1000000) * 1000;
+        timeout = &ts;
+    }
+
+    atomic_fetch_add(&data->work_waiters, 1);
+    while (atomic_load(&data->work_seq) == seq) {
+        if (futex(&data->work_seq, FUTEX_WAIT, seq, timeout) != 0 && errno == ETIMEDOUT) {
+            break;
+        }
+    }
+    atomic_fetch_sub(&data->work_waiters, 1);
+}
+
+// Publishes new work: wakes every waiter (there may be several free
+// questions), and skips the syscall when nobody is asleep.
+void notify_work(SharedData *data) {
+    atomic_fetch_add(&data->work_seq, 1);
+    if (atomic_load(&data->work_waiters) > 0) {
+        atomic_fetch_add(&data->work_wakes, 1);
+        futex(&data->work_seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+/* ---------------- exam list (scanned from the exam directory) ---------------- */
+
+// Filled by scan_exam_dir() in main before forking, so the TAs share it.
+ExamIndex exam_list;
+
+// 1 = rubric edits only touch shared memory and the flusher process
+// writes rubric.txt in the background (--write-behind).
+int write_behind = 0;
+
+// Per-TA event log rings (shared mapping, num_tas entries), and where the
+// log writer sends them: text on stdout, or raw records to a file.
+LogRing *log_rings = NULL;
+FILE *log_binary = NULL;
+
+// Exams in flight at once (--in-flight, at most MAX_EXAM_SLOTS).
+int exam_slots = 4;
+
+// Questions per exam (--questions, at most MAX_QUESTIONS).
+int num_questions = DEFAULT_QUESTIONS;
+
+// Question choice policy, and per-TA stats and deques (shared mappings,
+// num_tas entries each).
+Policy policy = POLICY_FIRST_FREE;
+TaStats *ta_stats = NULL;
+TaskDeque *deques = NULL;
+int num_tas = 0;
+
+// Task deque capacity (power of two) and bytes per deque in `deques`.
+int deque_size = 0;
+size_t deque_stride = 0;
+
+// Read-only mapping of a packed exam store (--store). When it is open the
+// TAs read exams straight out of it instead of opening exam files.
+ExamStore exam_store;
+
+// Percent chance a fork-mode TA process kills itself at each crash point
+// (--crash), to exercise the supervisor. Lease length in ms (--lease-ms).
+int crash_rate = 0;
+int lease_ms = LEASE_MS;
+
+// Supervisor only: a requeue found its deque full, so sweep again later.
+int requeue_pending = 0;
+
+// The main process, which every helper and TA process is a child of.
+pid_t main_pid = 0;
+
+// Number of exams available from the store or the scanned directory.
+int total_exams(void) {
+    return exam_store.hdr ? (int)exam_store.hdr->count : exam_list.count;
+}
+
+/* ---------------- shared region layout ---------------- */
+
+RubricLine *rubric_line(SharedData *data, int i) {
+    return (RubricLine *)((char *)data + data->rubric_off + i * data->rubric_stride);
+}
+
+// Claim words of a wide exam (more than FAST_QUESTIONS questions),
+// followed by its done words.
+atomic_ullong *claim_words(SharedData *data, ExamSlot *slot) {
+    return (atomic_ullong *)((char *)data + data->claimed_off +
+                             (slot - data->exams) * data->claim_stride);
+}
+
+atomic_ullong *done_words(SharedData *data, ExamSlot *slot) {
+    return claim_words(data, slot) + data->mask_words;
+}
+
+Lease *question_lease(SharedData *data, ExamSlot *slot, int q) {
+    Lease *leases = (Lease *)((char *)data + data->leases_off);
+    return &leases[(slot - data->exams) * num_questions + q];
+}
+
+atomic_llong *question_us(SharedData *data) {
+    return (atomic_llong *)((char *)data + data->question_us_off);
+}
+
+atomic_int *question_marks(SharedData *data) {
+    return (atomic_int *)((char *)data + data->question_marks_off);
+}
+
+size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+// Sizes the region for a rubric shape and num_questions and maps it:
+// anonymous, or from state_fd (--state), which is truncated to fit.
+// Returns NULL on error.
+SharedData *map_shared_data(int rubric_lines, int rubric_len, int state_fd) {
+    size_t rubric_stride = align_up(sizeof(RubricLine) + rubric_len, CACHE_LINE);
+    int mask_words = (num_questions + 63) / 64;
+    size_t claim_stride = align_up(2 * mask_words * sizeof(atomic_ullong), CACHE_LINE);
+
+    size_t rubric_off = align_up(sizeof(SharedData), CACHE_LINE);
+    size_t claimed_off = align_up(rubric_off + rubric_lines * rubric_stride, CACHE_LINE);
+    size_t leases_off = claimed_off;
+    if (num_questions > FAST_QUESTIONS) {
+        leases_off += MAX_EXAM_SLOTS * claim_stride;
+    }
+    size_t question_us_off = leases_off + (size_t)MAX_EXAM_SLOTS * num_questions * sizeof(Lease);
+    size_t question_marks_off = question_us_off + num_questions * sizeof(atomic_llong);
+    size_t map_size = question_marks_off + num_questions * sizeof(atomic_int);
+
+    if (state_fd >= 0 && ftruncate(state_fd, map_size) != 0) {
+        perror("ftruncate state");
+        return NULL;
+    }
+
+    SharedData *data = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                            state_fd >= 0 ? MAP_SHARED : MAP_SHARED | MAP_ANONYMOUS,
+                            state_fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    memset(data, 0, map_size);
+    data->header_size = sizeof(SharedData);
+    data->num_questions = num_questions;
+    data->exam_slots = exam_slots;
+    data->rubric_lines = rubric_lines;
+    data->rubric_len = rubric_len;
+    data->rubric_stride = rubric_stride;
+    data->mask_words = mask_words;
+    data->claim_stride = claim_stride;
+    data->rubric_off = rubric_off;
+    data->claimed_off = claimed_off;
+    data->leases_off = leases_off;
+    data->question_us_off = question_us_off;
+    data->question_marks_off = question_marks_off;
+    data->map_size = map_size;
+    return data;
+}
+
+/* ---------------- rubric helpers ---------------- */
+
+// Reads the rubric file into malloc'd lines (at most MAX_RUBRIC_LINES);
+// falls back to the default 5-line rubric if the file is missing.
+// Returns the number of lines and sets *max_len to the longest one.
+int read_rubric_file(const char *filename, char ***lines_out, int *max_len) {
+    static const char *defaults[] = {"1,A", "2,B", "3,C", "4,D", "5,E"};
+    char **lines = malloc(sizeof(char *) * MAX_RUBRIC_LINES);
+    int count = 0;
+    *max_len = 0;
+    if (!lines) {
+        perror("malloc rubric");
+        exit(1);
+    }
+
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        perror("fopen rubric");
+        // default rubric if file doesn't exist
+        for (; count < 5; count++) {
+            lines[count] = strdup(defaults[count]);
+        }
+        *max_len = 3;
+        *lines_out = lines;
+        return count;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    while (count < MAX_RUBRIC_LINES && getline(&line, &cap, f) >= 0) {
+        line[strcspn(line, "\r\n")] = '\0'; // strip newline
+        int len = (int)strlen(line);
+        if (len > *max_len) *max_len = len;
+        lines[count++] = strdup(line);
+    }
+
+    free(line);
+    fclose(f);
+    *lines_out = lines;
+    return count;
+}
+
+// Copies rubric lines into shared memory and frees them.
+void install_rubric(SharedData *data, char **lines) {
+    for (int i = 0; i < data->rubric_lines; i++) {
+        strcpy(rubric_line(data, i)->text, lines[i]);
+        free(lines[i]);
+    }
+    free(lines);
+}
+
+// Copies rubric line i into buf (rubric_len bytes) without taking any
+// lock. If a writer touched the line during the copy, the copy is thrown
+// away and retried. Returns the version the copy was taken at.
+unsigned int read_rubric_line(SharedData *data, int i, char *buf) {
+    RubricLine *line = rubric_line(data, i);
+    unsigned int seq;
+
+    do {
+        while ((seq = atomic_load_explicit(&line->seq, memory_order_acquire)) & 1) {
+            sched_yield(); // writer active; edits are a few instructions
+        }
+        memcpy(buf, line->text, data->rubric_len);
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&line->seq, memory_order_relaxed) != seq);
+
+    return seq;
+}
+
+// Sets the grade letter after the comma on line i, but only if the line
+// is still at `version`. Returns 1 if applied, 0 if another TA edited the
+// line first (the caller re-reads and decides again).
+int try_edit_rubric_line(SharedData *data, int i, unsigned int version, char new_char) {
+    RubricLine *line = rubric_line(data, i);
+
+    // version -> version + 1 both checks and locks the line
+    if (!atomic_compare_exchange_strong(&line->seq, &version, version + 1)) {
+        return 0;
+    }
+    atomic_thread_fence(memory_order_release);
+
+    char *comma = strchr(line->text, ',');
+    comma[1] = new_char;
+
+    atomic_store_explicit(&line->seq, version + 2, memory_order_release);
+    return 1;
+}
+
+// The letter after c. Long runs bump a line many times, so it wraps
+// from '~' back to '!' and the line stays printable (never a NUL).
+char next_grade(char c) {
+    return c >= '!' && c < '~' ? c + 1 : '!';
+}
+
+// Review-then-fix for line i: bumps the letter the TA saw in `line` if
+// nobody changed it meanwhile, otherwise re-reads and tries again.
+// Returns 1 and the letters if an edit was applied.
+int fix_rubric_line(SharedData *data, int i, unsigned int version, char *line,
+                    char *old_char, char *new_char) {
+    for (int retry = 0; retry <= RUBRIC_RETRIES; retry++) {
+        char *comma = strchr(line, ',');
+        if (comma == NULL || comma[1] == '\0') {
+            return 0;
+        }
+
+        *old_char = comma[1];
+        *new_char = next_grade(comma[1]);
+        atomic_fetch_add(&data->edit_attempts, 1);
+        if (try_edit_rubric_line(data, i, version, *new_char)) {
+            return 1;
+        }
+
+        // someone else fixed this line after we read it; look again
+        atomic_fetch_add(&data->edit_conflicts, 1);
+        version = read_rubric_line(data, i, line);
+    }
+
+    atomic_fetch_add(&data->edit_dropped, 1);
+    return 0;
+}
+
+// Takes a consistent copy of every rubric line: a malloc'd buffer with
+// line i at i * rubric_len. Returns NULL if out of memory.
+char *snapshot_rubric(SharedData *data) {
+    char *snapshot = malloc((size_t)data->rubric_lines * data->rubric_len);
+    if (!snapshot) {
+        perror("malloc rubric snapshot");
+        return NULL;
+    }
+    for (int i = 0; i < data->rubric_lines; i++) {
+        read_rubric_line(data, i, snapshot + (size_t)i * data->rubric_len);
+    }
+    return snapshot;
+}
+
+// Writes the rubric from shared memory back to rubric.txt.
+// Caller holds the rubric lock so two TAs never write the file at once.
+void save_rubric(SharedData *data, const char *filename) {
+    char *snapshot = snapshot_rubric(data);
+    if (!snapshot) {
+        return;
+    }
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        perror("fopen rubric for write");
+        free(snapshot);
+        return;
+    }
+
+    for (int i = 0; i < data->rubric_lines; i++) {
+        fprintf(f, "%s\n", snapshot + (size_t)i * data->rubric_len);
+    }
+
+    fclose(f);
+    free(snapshot);
+}
+
+// Writes a rubric snapshot to a temp file and renames it over filename,
+// so rubric.txt is always either the old or the new version.
+int save_rubric_atomic(SharedData *data, const char *snapshot, const char *filename) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        perror("fopen rubric temp");
+        return -1;
+    }
+
+    for (int i = 0; i < data->rubric_lines; i++) {
+        fprintf(f, "%s\n", snapshot + (size_t)i * data->rubric_len);
+    }
+
+    if (fclose(f) != 0 || rename(tmp, filename) != 0) {
+        perror("write rubric");
+        return -1;
+    }
+    return 0;
+}
+
+// Copies the rubric and writes it out if anything changed since the last
+// flush. The copy takes no lock, so reviewers never wait on the flusher.
+void flush_rubric(SharedData *data, unsigned int *flushed_edits) {
+    unsigned int edits = atomic_load(&data->rubric_edits);
+    if (edits == *flushed_edits) {
+        return;
+    }
+
+    char *snapshot = snapshot_rubric(data);
+    if (!snapshot) {
+        return;
+    }
+
+    if (save_rubric_atomic(data, snapshot, "rubric.txt") == 0) {
+        *flushed_edits = edits;
+        data->rubric_flushes++;
+    }
+    free(snapshot);
+}
+
+// Background writer for --write-behind: coalesces every edit made during
+// an interval into one rubric.txt rewrite, plus a final one at shutdown.
+void flusher_process(SharedData *data) {
+    unsigned int flushed_edits = 0;
+
+    // TAs can still be mid-review after finished is set, so run until
+    // main has reaped them all
+    while (!data->tas_exited) {
+        usleep(RUBRIC_FLUSH_MS * 1000);
+        flush_rubric(data, &flushed_edits);
+    }
+
+    flush_rubric(data, &flushed_edits);
+}
+
+/* ---------------- exam helpers ---------------- */
+
+// Reads one exam file and returns the student number (-1 on error).
+int load_exam(const char *filename) {
+    int student_id = -1;
+
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        perror("fopen exam");
+    } else {
+        char line[64];
+        if (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            student_id = atoi(line);
+        }
+        fclose(f);
+    }
+
+    return student_id;
+}
+
+/* ---------------- loader process ---------------- */
+
+// Adds one entry to the loader queue, waiting for room. Returns 0 if the
+// run finished while waiting.
+int loader_push(SharedData *data, int exam_index, int student_id) {
+    int tail = atomic_load(&data->loader_tail);
+    while (!data->finished && tail - atomic_load(&data->loader_head) >= LOADER_QUEUE) {
+        sem_wait(&data->loader_free);
+    }
+    if (data->finished) {
+        return 0;
+    }
+
+    LoadedExam *e = &data->loader_queue[tail % LOADER_QUEUE];
+    e->exam_index = exam_index;
+    e->student_id = student_id;
+    atomic_store(&data->loader_tail, tail + 1);
+
+    sem_trywait(&data->loader_free); // the wakeup for this entry, if not used up
+    sem_post(&data->loader_ready);
+    return 1;
+}
+
+// Reads exams in order and keeps the queue full ahead of the TAs, so an
+// exam transition only has to take an already parsed entry.
+void loader_process(SharedData *data) {
+    while (data->next_exam_index < total_exams()) {
+        int exam_index = data->next_exam_index++;
+        int student_id;
+        if (exam_store.hdr) {
+            // already parsed when the store was built
+            student_id = exam_store.entries[exam_index].student_id;
+        } else {
+            char path[512];
+            exam_path(&exam_list, exam_index, path, sizeof(path));
+            student_id = load_exam(path);
+        }
+
+        if (!loader_push(data, exam_index, student_id)) {
+            return;
+        }
+        if (student_id == 9999) {
+            return; // nothing gets loaded after the stop exam
+        }
+    }
+
+    // out of exams: tell the TAs nothing else is coming
+    loader_push(data, -1, -1);
+}
+
+/* ---------------- work-stealing deques ---------------- */
+
+TaskDeque *ta_deque(int i) {
+    return (TaskDeque *)((char *)deques + i * deque_stride);
+}
+
+// Owner only: adds a task at the bottom.
+void deque_push(TaskDeque *dq, int task) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    atomic_store_explicit(&dq->tasks[b & (deque_size - 1)], task, memory_order_relaxed);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+    dq->seeded++;
+}
+
+// Owner only: takes the newest task. Returns -1 if empty.
+int deque_pop(TaskDeque *dq) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    if (t > b) {
+        // already empty
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return -1;
+    }
+
+    int task = atomic_load_explicit(&dq->tasks[b & (deque_size - 1)], memory_order_relaxed);
+    if (t == b) {
+        // last task: race thieves for it
+        if (!atomic_compare_exchange_strong(&dq->top, &t, t + 1)) {
+            task = -1;
+        }
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+// Any TA: takes the oldest task. Returns -1 if empty or if another thief won.
+int deque_steal(TaskDeque *dq) {
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return -1;
+    }
+
+    int task = atomic_load_explicit(&dq->tasks[t & (deque_size - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong(&dq->top, &t, t + 1)) {
+        return -1;
+    }
+    return task;
+}
+
+// Own deque first, then steal, starting from a random victim so thieves
+// spread out. Returns a task or -1 if nobody had work.
+int take_task(TaState *ta) {
+    TaskDeque *own = ta_deque(ta->id - 1);
+    int task = deque_pop(own);
+    if (task >= 0 || num_tas < 2) {
+        return task;
+    }
+
+    // deque num_tas is the supervisor's, holding reclaimed tasks
+    int start = ta_rand(ta, num_tas + 1);
+    for (int n = 0; n <= num_tas; n++) {
+        int victim = (start + n) % (num_tas + 1);
+        if (victim == ta->id - 1) continue;
+
+        task = deque_steal(ta_deque(victim));
+        if (task >= 0) {
+            own->steals++;
+            return task;
+        }
+    }
+
+    own->steal_misses++;
+    return -1;
+}
+
+/* ---------------- exam slot helpers ---------------- */
+
+// --crash: a fork-mode TA process kills itself here with probability
+// crash_rate percent, as if it had crashed. ta is NULL outside a TA.
+void maybe_crash(TaState *ta) {
+    if (crash_rate > 0 && ta && ta->crashable && ta_rand(ta, 100) < crash_rate) {
+        raise(SIGKILL);
+    }
+}
+
+// Slots holding an exam. Caller holds the exam lock. Counted rather than
+// kept, so a TA that dies mid-transition can't leave it wrong.
+int slots_in_flight(SharedData *data) {
+    int n = 0;
+    for (int s = 0; s < exam_slots; s++) {
+        n += atomic_load(&data->exams[s].exam_index) >= 0;
+    }
+    return n;
+}
+
+// 1 if exam_index is already in a slot or was loaded before.
+int exam_taken(SharedData *data, int exam_index) {
+    if (exam_index < data->resume_exam) {
+        return 1;
+    }
+    for (int s = 0; s < exam_slots; s++) {
+        if (atomic_load(&data->exams[s].exam_index) == exam_index) return 1;
+    }
+    return 0;
+}
+
+// Records that the exam in queue entry e is in a slot. Also run for an
+// entry found taken, so it is safe to repeat.
+void note_loaded(SharedData *data, LoadedExam e) {
+    // a resumed run loads from the next exam
+    if (e.exam_index >= data->resume_exam) {
+        data->resume_exam = e.exam_index + 1;
+    }
+    if (e.student_id == 9999) {
+        data->stop_loading = 1; // the loader stops after the stop exam
+    }
+}
+
+// Takes the head entry off the loader queue. Caller holds the exam lock.
+void take_entry(SharedData *data) {
+    atomic_store(&data->loader_head, atomic_load(&data->loader_head) + 1);
+    sem_trywait(&data->loader_ready); // the wakeup for this entry, if not used up
+    sem_post(&data->loader_free);
+}
+
+// Loads the next exam into an empty slot. Caller holds the exam lock.
+// In steal mode the exam's questions go into deque `owner` as tasks.
+// ta is the TA doing the transition (NULL at startup).
+// Returns 1 if an exam was loaded, 0 if there are no more exams.
+//
+// A TA can die anywhere in here with the lock held, and the next holder
+// carries on from what is in the region: the entry stays at the head of
+// the queue until the exam is in the slot, and an entry whose exam is
+// already in a slot is just taken off. A slot that never got published
+// is swept by the supervisor (sweep_unleased).
+int fill_slot(SharedData *data, ExamSlot *slot, int owner, TaState *ta) {
+    LoadedExam next;
+    for (;;) {
+        if (data->stop_loading) {
+            return 0;
+        }
+
+        // normally the loader is ahead and this never blocks
+        int head = atomic_load(&data->loader_head);
+        if (head == atomic_load(&data->loader_tail)) {
+            long long start = now_us();
+            data->loader_stalls++;
+            while (head == atomic_load(&data->loader_tail)) {
+                sem_wait(&data->loader_ready);
+            }
+            data->loader_stall_us += now_us() - start;
+        }
+        maybe_crash(ta); // dies with an entry in view: it stays queued
+
+        next = data->loader_queue[head % LOADER_QUEUE];
+        if (next.exam_index < 0) {
+            data->stop_loading = 1;
+            take_entry(data);
+            return 0;
+        }
+        if (!exam_taken(data, next.exam_index)) {
+            break;
+        }
+
+        // loaded by a TA that died before taking it off the queue
+        note_loaded(data, next);
+        take_entry(data);
+    }
+
+    data->transitions++;
+
+    // clearing claimed last publishes the slot; until then every
+    // question looks taken so no TA can claim a half-loaded exam
+    slot->student_id = next.student_id;
+    slot->loaded_us = now_us();
+    atomic_store(&slot->done, 0);
+    if (num_questions > FAST_QUESTIONS) {
+        atomic_ullong *done = done_words(data, slot);
+        for (int w = 0; w < data->mask_words; w++) {
+            atomic_store(&done[w], 0);
+        }
+    }
+    for (int q = 0; q < num_questions; q++) {
+        Lease *l = question_lease(data, slot, q);
+        atomic_store(&l->ta, 0);
+        atomic_store(&l->done, 0);
+    }
+    atomic_store(&slot->exam_index, next.exam_index);
+    note_loaded(data, next);
+    maybe_crash(ta); // dies before publishing: the supervisor sweeps the slot
+    take_entry(data);
+
+    if (policy == POLICY_STEAL) {
+        // questions are handed out through the deques, never by claim bits
+        int slot_index = (int)(slot - data->exams);
+        for (int q = 0; q < num_questions; q++) {
+            deque_push(ta_deque(owner), slot_index * num_questions + q);
+        }
+    } else if (num_questions <= FAST_QUESTIONS) {
+        atomic_store(&slot->claimed, 0);
+    } else {
+        atomic_ullong *words = claim_words(data, slot);
+        for (int w = 0; w < data->mask_words; w++) {
+            atomic_store(&words[w], 0);
+        }
+    }
+    return 1;
+}
+
+// Every question bit of claim word w set.
+uint64_t full_word(int w) {
+    int bits = num_questions - 64 * w;
+    return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+// Marks a slot as empty so TAs skip it. Caller holds the exam lock.
+void clear_slot(SharedData *data, ExamSlot *slot) {
+    if (num_questions <= FAST_QUESTIONS) {
+        atomic_store(&slot->claimed, full_word(0));
+    } else {
+        atomic_ullong *words = claim_words(data, slot);
+        for (int w = 0; w < data->mask_words; w++) {
+            atomic_store(&words[w], full_word(w));
+        }
+    }
+    atomic_store(&slot->exam_index, -1);
+    slot->student_id = -1;
+}
+
+// 1 if some question in the slot is still unclaimed.
+int slot_has_free(SharedData *data, ExamSlot *slot) {
+    if (num_questions <= FAST_QUESTIONS) {
+        return atomic_load(&slot->claimed) != full_word(0);
+    }
+
+    atomic_ullong *words = claim_words(data, slot);
+    for (int w = 0; w < data->mask_words; w++) {
+        if (atomic_load(&words[w]) != full_word(w)) return 1;
+    }
+    return 0;
+}
+
+/* ---------------- question claim helpers ---------------- */
+
+// Index of the n-th set bit in mask (n counts from 0).
+int nth_bit(uint64_t mask, int n) {
+    while (n-- > 0) {
+        mask &= mask - 1;
+    }
+    return __builtin_ctzll(mask);
+}
+
+// Picks one question out of the free bits of claim word w (questions
+// 64 * w and up) according to the policy. Returns the bit index.
+int pick_question(SharedData *data, TaState *ta, int w, uint64_t free_mask) {
+    int base = 64 * w;
+
+    switch (policy) {
+    case POLICY_RANDOM:
+        return nth_bit(free_mask, ta_rand(ta, __builtin_popcountll(free_mask)));
+
+    case POLICY_ROUND_ROBIN:
+        // TAs start at different question numbers and rotate from there
+        for (int n = 0; n < num_questions; n++) {
+            int q = (ta->id - 1 + ta->rr_next + n) % num_questions - base;
+            if (q >= 0 && q < 64 && (free_mask & (1ULL << q))) return q;
+        }
+        break;
+
+    case POLICY_SHORTEST: {
+        // questions nobody has marked yet count as 0 so they get sampled
+        int best = -1;
+        long long best_avg = 0;
+        for (uint64_t m = free_mask; m; m &= m - 1) {
+            int q = __builtin_ctzll(m);
+            int marks = atomic_load(&question_marks(data)[base + q]);
+            long long avg = marks ? atomic_load(&question_us(data)[base + q]) / marks : 0;
+            if (best == -1 || avg < best_avg) {
+                best = q;
+                best_avg = avg;
+            }
+        }
+        return best;
+    }
+
+    case POLICY_AFFINITY: {
+        int q = ta->last_question - base;
+        if (q >= 0 && q < 64 && (free_mask & (1ULL << q))) {
+            return q;
+        }
+        break;
+    }
+
+    case POLICY_FIRST_FREE:
+    case POLICY_STEAL:      // steal mode hands out tasks, never claims bits
+        break;
+    }
+
+    return __builtin_ctzll(free_mask);
+}
+
+// Claims a free bit of one claim word with fetch-or. Returns the bit, or
+// -1 once the word is full. Lost races count as claim retries.
+int claim_in_word(SharedData *data, TaState *ta, atomic_ullong *word, int w) {
+    uint64_t full = full_word(w);
+    uint64_t claimed = atomic_load(word);
+
+    while (claimed != full) {
+        int q = pick_question(data, ta, w, ~claimed & full);
+        uint64_t bit = 1ULL << q;
+
+        // fetch-or returns the old mask: if our bit was clear we own it,
+        // otherwise another TA won and the old mask is our fresh view
+        claimed = atomic_fetch_or(word, bit);
+        if (!(claimed & bit)) {
+            return q;
+        }
+        ta_stats[ta->id - 1].claim_retries++;
+    }
+
+    return -1;
+}
+
+// Claims a free question in a slot without any semaphore, choosing it
+// with the TA's policy. Returns the question index, or -1 if every
+// question is already claimed.
+int claim_question(SharedData *data, TaState *ta, ExamSlot *slot) {
+    if (num_questions <= FAST_QUESTIONS) {
+        return claim_in_word(data, ta, &slot->claimed, 0);
+    }
+
+    // wide exam: start in the word the policy prefers, then wrap around
+    int words = data->mask_words;
+    int start = 0;
+    if (policy == POLICY_RANDOM) {
+        start = ta_rand(ta, words);
+    } else if (policy == POLICY_ROUND_ROBIN) {
+        start = (ta->id - 1 + ta->rr_next) % num_questions / 64;
+    } else if (policy == POLICY_AFFINITY && ta->last_question >= 0) {
+        start = ta->last_question / 64;
+    }
+
+    atomic_ullong *claimed = claim_words(data, slot);
+    for (int n = 0; n < words; n++) {
+        int w = (start + n) % words;
+        int q = claim_in_word(data, ta, &claimed[w], w);
+        if (q != -1) {
+            return 64 * w + q;
+        }
+    }
+    return -1;
+}
+
+// 1 if every question of the slot's exam is marked.
+int slot_complete(SharedData *data, ExamSlot *slot) {
+    if (num_questions <= FAST_QUESTIONS) {
+        return atomic_load(&slot->done) == full_word(0);
+    }
+
+    atomic_ullong *done = done_words(data, slot);
+    for (int w = 0; w < data->mask_words; w++) {
+        if (atomic_load(&done[w]) != full_word(w)) return 0;
+    }
+    return 1;
+}
+
+// Marks question q finished, in its lease and the slot's done mask. Only
+// sets bits, so the supervisor can safely redo it for a TA that died
+// partway. Returns 1 if the exam is now complete; more than one caller
+// can see that, and finish_exam sorts it out under the exam lock.
+int complete_question(SharedData *data, ExamSlot *slot, int q) {
+    atomic_store(&question_lease(data, slot, q)->done, 1);
+    if (num_questions <= FAST_QUESTIONS) {
+        uint64_t bit = 1ULL << q;
+        return (atomic_fetch_or(&slot->done, bit) | bit) == full_word(0);
+    }
+
+    int w = q / 64;
+    uint64_t bit = 1ULL << (q % 64);
+    if ((atomic_fetch_or(&done_words(data, slot)[w], bit) | bit) != full_word(w)) {
+        return 0;
+    }
+    return slot_complete(data, slot);
+}
+
+/* ---------------- leases ---------------- */
+
+// Takes the lease on the question the TA just claimed or was handed.
+// Fails if another TA holds it or it is already marked (a stale claim
+// or duplicate task). The deadline goes first, so anyone who sees the
+// owner sees its deadline. Returns 1 if the question is now the TA's.
+int take_lease(SharedData *data, TaState *ta) {
+    Lease *l = question_lease(data, ta->slot, ta->question);
+    if (atomic_load(&l->ta) != 0) {
+        return 0;
+    }
+
+    atomic_store(&l->deadline_us, now_us() + scaled_delay(lease_ms * 1000L));
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&l->ta, &expected, ta->id)) {
+        return 0;
+    }
+    if (atomic_load(&l->done)) {
+        atomic_store(&l->ta, 0);
+        return 0;
+    }
+    return 1;
+}
+
+// Takes TA ta_id's lease on question q away from it. Returns 1 if it
+// still held it, 0 if it didn't (or is already completing).
+int drop_lease(SharedData *data, ExamSlot *slot, int q, int ta_id) {
+    int expected = ta_id;
+    return atomic_compare_exchange_strong(&question_lease(data, slot, q)->ta, &expected, 0);
+}
+
+// Starts completing a marked question: ta_id -> -ta_id, after which the
+// lease can't be taken back. Returns 0 if it already was (the mark is void).
+int begin_completion(SharedData *data, ExamSlot *slot, int q, int ta_id) {
+    int expected = ta_id;
+    return atomic_compare_exchange_strong(&question_lease(data, slot, q)->ta, &expected, -ta_id);
+}
+
+// Frees the lease once the question is complete. A no-op if the slot was
+// already refilled, which frees every lease of the new exam itself.
+void end_completion(SharedData *data, ExamSlot *slot, int q, int ta_id) {
+    int expected = -ta_id;
+    atomic_compare_exchange_strong(&question_lease(data, slot, q)->ta, &expected, 0);
+}
+
+// Puts question q of slot s back in the pool: its claim bit is cleared,
+// or in steal mode it is queued on the supervisor's deque. Supervisor
+// only. Returns 0 if that deque is full; requeue_pending then asks for
+// another sweep once TAs have drained it.
+int requeue_question(SharedData *data, int s, int q) {
+    ExamSlot *slot = &data->exams[s];
+    if (policy == POLICY_STEAL) {
+        TaskDeque *dq = ta_deque(num_tas);
+        if (atomic_load(&dq->bottom) - atomic_load(&dq->top) >= deque_size) {
+            requeue_pending = 1;
+            return 0;
+        }
+        deque_push(dq, s * num_questions + q);
+    } else if (num_questions <= FAST_QUESTIONS) {
+        atomic_fetch_and(&slot->claimed, ~(1ULL << q));
+    } else {
+        atomic_fetch_and(&claim_words(data, slot)[q / 64], ~(1ULL << (q % 64)));
+    }
+    return 1;
+}
+
+// Takes question q of slot s back from TA ta_id, if it still holds the
+// lease, and returns it to the pool. Supervisor only. Returns 1 if the
+// question was reclaimed.
+int reclaim_lease(SharedData *data, int s, int q, int ta_id) {
+    if (!drop_lease(data, &data->exams[s], q, ta_id)) {
+        return 0;
+    }
+    requeue_question(data, s, q);
+    return 1;
+}
+
+/* ---------------- work selection ---------------- */
+
+// Finds a question to mark: from the TA's deque or a victim's in steal
+// mode, otherwise by claiming one in the oldest exam with a free question
+// (exams finish in order but nobody waits while a later one has work).
+// Returns the question and sets *slot_out, or -1 if there is no work.
+int find_work(SharedData *data, TaState *ta, ExamSlot **slot_out) {
+    if (policy == POLICY_STEAL) {
+        int task = take_task(ta);
+        if (task < 0) return -1;
+        *slot_out = &data->exams[task / num_questions];
+        return task % num_questions;
+    }
+
+    // slots that still have free questions, oldest exam first
+    int order[MAX_EXAM_SLOTS], order_index[MAX_EXAM_SLOTS];
+    int n = 0;
+    for (int s = 0; s < exam_slots; s++) {
+        int idx = atomic_load(&data->exams[s].exam_index);
+        if (idx < 0 || !slot_has_free(data, &data->exams[s])) continue;
+
+        int j = n++;
+        while (j > 0 && order_index[j - 1] > idx) {
+            order[j] = order[j - 1];
+            order_index[j] = order_index[j - 1];
+            j--;
+        }
+        order[j] = s;
+        order_index[j] = idx;
+    }
+
+    for (int k = 0; k < n; k++) {
+        ExamSlot *e = &data->exams[order[k]];
+        int q = claim_question(data, ta, e);
+        if (q != -1) {
+            // slot can't be reloaded until our question is done
+            *slot_out = e;
+            return q;
+        }
+    }
+
+    return -1;
+}
+
+/* ---------------- event log ---------------- */
+
+// Appends one event to the TA's ring. If the writer has fallen a whole
+// ring behind, waits for it rather than dropping the event.
+void ta_log(SharedData *data, int ta_id, EventType type, int student, int arg,
+            char old_char, char new_char) {
+    LogRing *ring = &log_rings[ta_id - 1];
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE) {
+        atomic_fetch_add(&data->log_rings_full, 1);
+        while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE) {
+            sched_yield();
+        }
+    }
+
+    LogRecord *r = &ring->records[head & (LOG_RING_SIZE - 1)];
+    r->time_us = now_us();
+    r->ta = ta_id;
+    r->student = student;
+    r->type = type;
+    r->arg = arg;
+    r->old_char = old_char;
+    r->new_char = new_char;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Formats an event as the original human-readable log line.
+int format_event(const LogRecord *r, char *buf, size_t len) {
+    switch (r->type) {
+    case EV_STARTED:
+        return snprintf(buf, len, "TA %d: Started\n", r->ta);
+    case EV_REVIEW_START:
+        return snprintf(buf, len, "TA %d: Reviewing rubric\n", r->ta);
+    case EV_RUBRIC_MODIFIED:
+        return snprintf(buf, len, "TA %d: Modified rubric line %d: '%c' -> '%c'\n",
+                        r->ta, r->arg, r->old_char, r->new_char);
+    case EV_REVIEW_DONE:
+        return snprintf(buf, len, "TA %d: Finished reviewing rubric\n", r->ta);
+    case EV_MARK_START:
+        return snprintf(buf, len, "TA %d: Marking question %d for student %d\n",
+                        r->ta, r->arg, r->student);
+    case EV_MARK_DONE:
+        return snprintf(buf, len, "TA %d: Finished marking question %d for student %d\n",
+                        r->ta, r->arg, r->student);
+    case EV_EXAM_DONE:
+        return snprintf(buf, len, "TA %d: All questions marked for student %d\n",
+                        r->ta, r->student);
+    case EV_STOP_EXAM:
+        return snprintf(buf, len, "TA %d: Reached student 9999, finishing\n", r->ta);
+    case EV_NEXT_EXAM:
+        return snprintf(buf, len, "TA %d: Moving to next exam (student %d)\n",
+                        r->ta, r->student);
+    case EV_STOPPED:
+        return snprintf(buf, len, "TA %d: Stopped\n", r->ta);
+    }
+    return snprintf(buf, len, "TA %d: unknown event %d\n", r->ta, r->type);
+}
+
+// Orders a drained batch by time; ties keep ring order (seq).
+typedef struct {
+    LogRecord rec;
+    long      seq;
+} LogBatchEntry;
+
+int compare_batch_entries(const void *a, const void *b) {
+    const LogBatchEntry *x = a;
+    const LogBatchEntry *y = b;
+    if (x->rec.time_us != y->rec.time_us) return x->rec.time_us < y->rec.time_us ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+// Drains every ring once, sorts what it found by time and writes it out
+// with one buffered write. Returns the number of events written.
+int drain_log_rings(LogBatchEntry *batch) {
+    int n = 0;
+    for (int i = 0; i < num_tas; i++) {
+        LogRing *ring = &log_rings[i];
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            batch[n].rec = ring->records[tail & (LOG_RING_SIZE - 1)];
+            batch[n].seq = n;
+            n++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    qsort(batch, n, sizeof(*batch), compare_batch_entries);
+    for (int i = 0; i < n; i++) {
+        if (log_binary) {
+            fwrite(&batch[i].rec, sizeof(LogRecord), 1, log_binary);
+        } else {
+            char line[128];
+            int len = format_event(&batch[i].rec, line, sizeof(line));
+            fwrite(line, 1, len, stdout);
+        }
+    }
+    fflush(log_binary ? log_binary : stdout);
+    return n;
+}
+
+// The only process that writes TA events: keeps draining the rings until
+// main has reaped every TA, then drains whatever is left.
+void log_writer_process(SharedData *data) {
+    LogBatchEntry *batch = malloc(sizeof(LogBatchEntry) * num_tas * LOG_RING_SIZE);
+    if (!batch) {
+        perror("malloc log batch");
+        exit(1);
+    }
+
+    while (!data->tas_exited) {
+        if (drain_log_rings(batch) == 0) {
+            usleep(1000);
+        }
+    }
+    while (drain_log_rings(batch) > 0) {
+    }
+
+    free(batch);
+}
+
+// --log-dump: prints a binary event log as text, with timestamps.
+int dump_log_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("fopen log");
+        return 1;
+    }
+
+    LogFileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, LOG_FILE_MAGIC, 4) != 0 ||
+        hdr.version != LOG_FILE_VERSION || hdr.record_size != sizeof(LogRecord)) {
+        fprintf(stderr, "%s: not a TA event log\n", path);
+        fclose(f);
+        return 1;
+    }
+
+    LogRecord r;
+    char line[128];
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        format_event(&r, line, sizeof(line));
+        printf("%12.3f ms  %s", r.time_us / 1000.0, line);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+/* ---------------- TA logic (synchronized) ---------------- */
+
+// Exam transition for ta->slot: empties it if its exam is fully marked
+// and loads the next exam into it. Called by a TA that completed an
+// exam's last question, and by the supervisor for a TA that died before
+// its transition was done, so the slot is checked again under the exam
+// lock: if another caller already moved it on, nothing happens. An empty
+// slot (a transition cut short) is just refilled.
+// Returns 1 if that was the end of the run.
+int finish_exam(SharedData *data, TaState *ta) {
+    TaStats *stats = &ta_stats[ta->id - 1];
+    ExamSlot *slot = ta->slot;
+
+    // Protect exam transitions so only one TA loads at a time
+    timed_lock(data, LOCK_BIT(EXAM_LOCK), ta->id, &stats->exam_wait_us, &data->exam_wait);
+    maybe_crash(ta); // dies holding the exam lock: the next owner recovers it
+
+    int in_flight = atomic_load(&slot->exam_index) >= 0;
+    if (in_flight && !slot_complete(data, slot)) {
+        // already moved on to the next exam
+        lock_release_set(&data->locks, LOCK_BIT(EXAM_LOCK));
+        return 0;
+    }
+
+    if (in_flight) {
+        hist_record(&data->exam_latency, now_us() - slot->loaded_us);
+        ta_log(data, ta->id, EV_EXAM_DONE, slot->student_id, 0, 0, 0);
+
+        if (slot->student_id == 9999) {
+            ta_log(data, ta->id, EV_STOP_EXAM, slot->student_id, 0, 0, 0);
+        }
+
+        clear_slot(data, slot);
+        maybe_crash(ta); // dies with the slot empty: the supervisor refills it
+    }
+
+    // move to next exam
+    int loaded = 0, last = 0;
+    if (fill_slot(data, slot, ta->id - 1, ta)) {
+        ta_log(data, ta->id, EV_NEXT_EXAM, slot->student_id, 0, 0, 0);
+        loaded = 1;
+    } else if (slots_in_flight(data) == 0) {
+        // stop exam marked and nothing left in flight
+        data->finished = 1;
+        last = 1;
+    }
+
+    lock_release_set(&data->locks, LOCK_BIT(EXAM_LOCK));
+
+    // idle TAs are asleep until there is a new exam or nothing left to do
+    if (loaded || last) {
+        notify_work(data);
+    }
+    return last;
+}
+
+// text is the TA's rubric line buffer, rubric_len bytes.
+void ta_init(TaState *ta, int ta_id, char *text) {
+    memset(ta, 0, sizeof(*ta));
+    ta->id = ta_id;
+    ta->text = text;
+    ta->phase = TA_START;
+    // TA id picks the stream; a respawned TA gets fresh numbers
+    pcg32_seed(&ta->rng, run_seed + ta_stats[ta_id - 1].respawns, ta_id);
+    ta->last_question = -1;
+}
+
+#define STEP_STOPPED   (-1)   // ta_step: the TA has stopped
+#define STEP_WAIT_WORK (-2)   // ta_step: no free question until work_seq moves on
+
+// Runs a TA until it next has to wait. Returns how long to wait (us)
+// before calling it again, STEP_WAIT_WORK to sleep until work_seq moves
+// past ta->work_seq, or STEP_STOPPED once the TA has stopped. No lock is
+// ever held between calls.
+long ta_step(TaState *ta, SharedData *data) {
+    TaStats *stats = &ta_stats[ta->id - 1];
+
+    for (;;) {
+        switch (ta->phase) {
+        case TA_START:
+            if (data->finished) {
+                ta_log(data, ta->id, EV_STOPPED, -1, 0, 0, 0);
+                ta->phase = TA_STOPPED;
+                return STEP_STOPPED;
+            }
+
+            /* ----- RUBRIC SECTION (lock-free reads, per-line writes) ----- */
+
+            // Any number of TAs review at once and no lock is held during the
+            // review delay; an edit applies only against the version reviewed.
+            ta_log(data, ta->id, EV_REVIEW_START, -1, 0, 0, 0);
+            ta->review_start = now_us();
+            ta->line = 0;
+            ta->phase = TA_REVIEW_LINE;
+            break;
+
+        case TA_REVIEW_LINE:
+            ta->version = read_rubric_line(data, ta->line, ta->text);
+            ta->phase = TA_REVIEW_DONE;
+            return random_delay(ta, 500, 1000); // 0.5–1s
+
+        case TA_REVIEW_DONE: {
+            // 20% chance this TA decides to correct the rubric line
+            char old_char, new_char;
+            if (ta_rand(ta, 100) < 20 &&
+                fix_rubric_line(data, ta->line, ta->version, ta->text, &old_char, &new_char)) {
+                ta_log(data, ta->id, EV_RUBRIC_MODIFIED, -1, ta->line + 1, old_char, new_char);
+
+                if (write_behind) {
+                    // the flusher process writes it out later
+                    atomic_fetch_add(&data->rubric_edits, 1);
+                } else {
+                    // write the file under the rubric lock; the line itself is already updated
+                    timed_lock(data, LOCK_BIT(RUBRIC_LOCK), ta->id, &stats->rubric_wait_us, &data->rubric_wait);
+                    save_rubric(data, "rubric.txt");
+                    lock_release_set(&data->locks, LOCK_BIT(RUBRIC_LOCK));
+                }
+            }
+
+            if (++ta->line < data->rubric_lines) {
+                ta->phase = TA_REVIEW_LINE;
+                break;
+            }
+
+            ta_log(data, ta->id, EV_REVIEW_DONE, -1, 0, 0, 0);
+            stats->review_us += now_us() - ta->review_start;
+            ta->phase = TA_FIND_WORK;
+            break;
+        }
+
+        case TA_FIND_WORK:
+            /* ----- QUESTION SELECTION SECTION (lock-free claim) ----- */
+            // read before looking, so work published after this wakes us
+            ta->work_seq = atomic_load(&data->work_seq);
+            ta->slot = NULL;
+            ta->question = find_work(data, ta, &ta->slot);
+            if (ta->question == -1) {
+                if (data->finished) {
+                    ta->phase = TA_START;
+                    break;
+                }
+                // every question is taken: sleep until an exam is loaded
+                // or the run ends, then look again
+                stats->work_waits++;
+                return STEP_WAIT_WORK;
+            }
+
+            maybe_crash(ta); // dies holding a claim with no lease: the supervisor frees it
+            if (!take_lease(data, ta)) {
+                // stale claim or task: someone else has it, or it is marked
+                break;
+            }
+            ta->student_id = ta->slot->student_id;
+            ta_log(data, ta->id, EV_MARK_START, ta->student_id, ta->question + 1, 0, 0);
+            maybe_crash(ta); // dies mid-mark: the supervisor reclaims the lease
+
+            // 1–2s marking time (no need to hold a lock during the wait)
+            ta->mark_start = now_us();
+            ta->phase = TA_MARK_DONE;
+            return random_delay(ta, MARK_MIN_MS, MARK_MAX_MS);
+
+        case TA_MARK_DONE: {
+            if (!begin_completion(data, ta->slot, ta->question, ta->id)) {
+                // took too long: the question went back to the pool
+                atomic_fetch_add(&data->leases_lost, 1);
+                ta->phase = TA_START;
+                return scaled_delay(50000);
+            }
+
+            long long mark_us = now_us() - ta->mark_start;
+            stats->questions++;
+            stats->mark_us += mark_us;
+            atomic_fetch_add(&question_us(data)[ta->question], mark_us);
+            atomic_fetch_add(&question_marks(data)[ta->question], 1);
+            ta->last_question = ta->question;
+            ta->rr_next++;
+
+            ta_log(data, ta->id, EV_MARK_DONE, ta->student_id, ta->question + 1, 0, 0);
+
+            /* ----- CHECK IF EXAM IS DONE ----- */
+
+            // The lease is held (completing) until the question is in the
+            // done mask, so the exam can't be reloaded under it.
+            maybe_crash(ta); // dies mid-completion: the supervisor completes it
+            int complete = complete_question(data, ta->slot, ta->question);
+            end_completion(data, ta->slot, ta->question, ta->id);
+
+            ta->phase = TA_START;
+            if (complete && finish_exam(data, ta)) {
+                break; // run is over: stop without the usual pause
+            }
+            return scaled_delay(50000); // small delay so output isn't too spammy
+        }
+
+        case TA_STOPPED:
+            return STEP_STOPPED;
+        }
+    }
+}
+
+/* ---------------- TA runtimes ---------------- */
+
+// Fork mode: one process per TA, sleeping for real between steps.
+void ta_process(int ta_id, SharedData *data) {
+    TaState ta;
+    char *text = malloc(data->rubric_len);
+    if (!text) {
+        perror("malloc");
+        exit(1);
+    }
+    ta_init(&ta, ta_id, text);
+    ta.crashable = 1;
+
+    ta_log(data, ta_id, EV_STARTED, -1, 0, 0, 0);
+
+    long delay;
+    while ((delay = ta_step(&ta, data)) != STEP_STOPPED) {
+        if (delay == STEP_WAIT_WORK) {
+            wait_for_work(data, ta.work_seq, -1);
+        } else {
+            usleep(delay);
+        }
+    }
+    free(text);
+}
+
+/* ---------------- supervisor ---------------- */
+
+// Called first thing in every child of main: it gets SIGKILL when main
+// dies, so a killed run leaves no TA or helper behind still writing the
+// shared region (with --state, the file a later --resume reads).
+void die_with_parent(void) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != main_pid) {
+        _exit(1); // main died before the prctl
+    }
+}
+
+// Puts every question of an in-flight exam that is neither marked nor
+// leased back in the pool. A TA that dies between claiming (or popping a
+// task) and taking the lease leaves nothing else to find its question
+// by, and one that dies loading an exam leaves it unpublished. Live TAs' claims get swept too, and in steal mode tasks still
+// queued are queued twice; both are harmless, since only the lease
+// decides who marks. Returns the number of questions requeued; if the
+// supervisor's deque filled up, requeue_pending is set again.
+int sweep_unleased(SharedData *data) {
+    int requeued = 0;
+    requeue_pending = 0;
+    for (int s = 0; s < exam_slots; s++) {
+        if (atomic_load(&data->exams[s].exam_index) < 0) continue;
+
+        for (int q = 0; q < num_questions; q++) {
+            Lease *l = question_lease(data, &data->exams[s], q);
+            if (atomic_load(&l->ta) == 0 && !atomic_load(&l->done)) {
+                if (!requeue_question(data, s, q)) {
+                    return requeued;
+                }
+                requeued++;
+            }
+        }
+    }
+    return requeued;
+}
+
+// Runs every exam transition that is due: exams that are complete and
+// slots left empty, e.g. by a TA that died before or during its
+// transition (the exam lock comes back through the robust mutex). An
+// empty slot after the stop exam still ends the run if it was the last.
+// `owner` is the TA whose deque gets steal-mode tasks.
+void finish_due_exams(SharedData *data, int owner) {
+    TaState ta;
+    memset(&ta, 0, sizeof(ta));
+    ta.id = owner;
+
+    for (int s = 0; s < exam_slots; s++) {
+        ExamSlot *slot = &data->exams[s];
+        int in_flight = atomic_load(&slot->exam_index) >= 0;
+        if (in_flight ? slot_complete(data, slot) : !data->finished) {
+            ta.slot = slot;
+            finish_exam(data, &ta);
+        }
+    }
+}
+
+// Cleans up after a dead TA: questions it was marking go back to the
+// pool, and one it was completing is completed on its behalf (the mark
+// already counted). Tasks still in its deque move to the supervisor's,
+// unleased questions are swept back, and any transition it didn't get
+// to is run.
+void reclaim_dead_ta(SharedData *data, int ta_id) {
+    for (int s = 0; s < exam_slots; s++) {
+        ExamSlot *slot = &data->exams[s];
+        for (int q = 0; q < num_questions; q++) {
+            int holder = atomic_load(&question_lease(data, slot, q)->ta);
+            if (holder == ta_id && reclaim_lease(data, s, q, ta_id)) {
+                atomic_fetch_add(&data->leases_dead, 1);
+            } else if (holder == -ta_id) {
+                complete_question(data, slot, q);
+                end_completion(data, slot, q, ta_id);
+            }
+        }
+    }
+
+    if (policy == POLICY_STEAL) {
+        // nobody owns the deque now, so the supervisor can pop it
+        TaskDeque *dq = ta_deque(num_tas);
+        int task;
+        while (atomic_load(&dq->bottom) - atomic_load(&dq->top) < deque_size &&
+               (task = deque_pop(ta_deque(ta_id - 1))) >= 0) {
+            deque_push(dq, task);
+        }
+    }
+
+    sweep_unleased(data);
+    finish_due_exams(data, ta_id);
+    notify_work(data);
+}
+
+// Takes back leases that ran past their deadline, so a stuck TA can't
+// hold an exam back. When it wakes up, its mark is dropped.
+void reclaim_expired(SharedData *data) {
+    long long now = now_us();
+    for (int s = 0; s < exam_slots; s++) {
+        if (atomic_load(&data->exams[s].exam_index) < 0) continue;
+
+        for (int q = 0; q < num_questions; q++) {
+            Lease *l = question_lease(data, &data->exams[s], q);
+            int ta_id = atomic_load(&l->ta);
+            if (ta_id > 0 && atomic_load(&l->deadline_us) < now &&
+                reclaim_lease(data, s, q, ta_id)) {
+                atomic_fetch_add(&data->leases_expired, 1);
+                notify_work(data);
+            }
+        }
+    }
+}
+
+// Fork mode: the parent's wait loop. Polls the TA processes every
+// SUPERVISE_MS; a TA that exits normally is done, one that dies has its
+// work reclaimed and is started again (unless the run is over). Expired
+// leases are reclaimed on every pass.
+void supervise_tas(SharedData *data, pid_t *pids) {
+    int running = num_tas;
+    while (running > 0) {
+        for (int i = 0; i < num_tas; i++) {
+            int status;
+            if (pids[i] <= 0 || waitpid(pids[i], &status, WNOHANG) != pids[i]) continue;
+
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                pids[i] = 0;
+                running--;
+                continue;
+            }
+
+            printf("Supervisor: TA %d (pid %d) died", i + 1, pids[i]);
+            if (WIFSIGNALED(status)) {
+                printf(" (signal %d)", WTERMSIG(status));
+            }
+            reclaim_dead_ta(data, i + 1);
+            if (data->finished) {
+                printf(", run is over\n");
+                fflush(stdout);
+                pids[i] = 0;
+                running--;
+                continue;
+            }
+
+            printf(", restarting it\n");
+            fflush(stdout);
+            ta_stats[i].respawns++;
+            data->respawns++;
+            pids[i] = fork();
+            if (pids[i] < 0) {
+                perror("fork");
+                pids[i] = 0;
+                running--;
+            } else if (pids[i] == 0) {
+                die_with_parent();
+                ta_process(i + 1, data);
+                exit(0);
+            }
+        }
+
+        reclaim_expired(data);
+        if (requeue_pending && sweep_unleased(data) > 0) {
+            notify_work(data); // idle TAs sleep until told there is work
+        }
+        usleep(SUPERVISE_MS * 1000);
+    }
 }
 
-/* ---------------- exam file list (matches your exams/ dir) ---------------- */
+/* ---------------- state file ---------------- */
 
-const char *exam_files[] = {
-    "exams/0001","exams/0002","exams/0003","exams/0004","exams/0005","exams/0010","exams/0015",
-    "exams/0020","exams/0025","exams/0030","exams/0100","exams/0200","exams/0300","exams/0500",
-    "exams/1000","exams/1500","exams/2000","exams/3000","exams/5000","exams/7000","exams/8000",
-    "exams/8500","exams/9000","exams/9500",
-    "exams/9999"   // stop exam
-};
-const int NUM_EXAMS = sizeof(exam_files) / sizeof(exam_files[0]);
-
-/* ---------------- rubric helpers ---------------- */
+// 1 if fd holds a run saved by --state (of any version), so starting
+// afresh would erase it.
+int holds_saved_run(int fd) {
+    char magic[sizeof(STATE_MAGIC)];
+    return pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+           memcmp(magic, STATE_MAGIC, sizeof(STATE_MAGIC)) == 0;
+}
 
-// Reads rubric.txt into shared memory; falls back to defaults if file missing.
-void load_rubric(SharedData *data, const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        perror("fopen rubric");
-        // default rubric if file doesn't exist
-        strcpy(data->rubric[0], "1,A");
-        strcpy(data->rubric[1], "2,B");
-        strcpy(data->rubric[2], "3,C");
-        strcpy(data->rubric[3], "4,D");
-        strcpy(data->rubric[4], "5,E");
-        return;
+// Maps an existing --state file for --resume. The file must hold a
+// complete setup written by this version; the run then takes its shape
+// (questions per exam, exams in flight) from the file, not the options.
+// Returns NULL on error.
+SharedData *map_state_file(int fd, const char *path) {
+    SharedData hdr;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a complete state file\n", path);
+        return NULL;
+    }
+    if (hdr.version != STATE_VERSION || hdr.header_size != (int)sizeof(SharedData)) {
+        fprintf(stderr, "%s: state version %d (%d byte header), this build reads %d (%zu bytes)\n",
+                path, hdr.version, hdr.header_size, STATE_VERSION, sizeof(SharedData));
+        return NULL;
     }
 
-    char line[64];
-    for (int i = 0; i < MAX_RUBRIC_LINES; i++) {
-        if (!fgets(line, sizeof(line), f)) break;
-        line[strcspn(line, "\r\n")] = '\0'; // strip newline
-        strncpy(data->rubric[i], line, sizeof(data->rubric[i]) - 1);
-        data->rubric[i][sizeof(data->rubric[i]) - 1] = '\0';
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != hdr.map_size) {
+        fprintf(stderr, "%s: truncated state file\n", path);
+        return NULL;
     }
 
-    fclose(f);
+    SharedData *data = mmap(NULL, hdr.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap state");
+        return NULL;
+    }
+    num_questions = data->num_questions;
+    exam_slots = data->exam_slots;
+    return data;
 }
 
-// Writes the rubric from shared memory back to rubric.txt.
-void save_rubric(SharedData *data, const char *filename) {
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-        perror("fopen rubric for write");
-        return;
+// Clears what belonged to the processes of the earlier run before the
+// loader starts again: run flags, sleepers, and the loader queue, whose
+// parsed entries are dropped and re-read from resume_exam. Locks and
+// semaphores are initialized afresh by main either way.
+void reset_state(SharedData *data) {
+    // fill_slot publishes an exam before it records resume_exam and the
+    // stop flag, so a run killed in between left the slot ahead of them
+    for (int s = 0; s < exam_slots; s++) {
+        int idx = atomic_load(&data->exams[s].exam_index);
+        if (idx < 0) continue;
+        if (idx >= data->resume_exam) {
+            data->resume_exam = idx + 1;
+        }
+        if (data->exams[s].student_id == 9999) {
+            data->stop_loading = 1;
+        }
     }
 
-    for (int i = 0; i < MAX_RUBRIC_LINES; i++) {
-        fprintf(f, "%s\n", data->rubric[i]);
-    }
+    data->finished = 0;
+    data->tas_exited = 0;
+    data->next_exam_index = data->resume_exam;
+    atomic_store(&data->loader_head, 0);
+    atomic_store(&data->loader_tail, 0);
+    atomic_store(&data->work_waiters, 0);
+    data->resumes++;
 
-    fclose(f);
+    // a TA killed mid-edit leaves its line odd (locked); the edit is one
+    // byte, so the text is whole either way
+    for (int i = 0; i < data->rubric_lines; i++) {
+        RubricLine *line = rubric_line(data, i);
+        if (atomic_load(&line->seq) & 1) {
+            atomic_fetch_add(&line->seq, 1);
+        }
+    }
 }
 
-/* ---------------- exam helpers ---------------- */
+// Rebuilds every slot from its leases once the loader is running.
+// Marked questions stay marked; every other question of an in-flight
+// exam goes back to the pool (claim bit cleared, or a task in steal
+// mode), since whoever was marking it is gone. A fully marked exam whose
+// transition never ran is cleared, and empty slots are filled as at
+// startup. Returns the number of marked questions kept.
+int resume_slots(SharedData *data) {
+    int kept = 0;
 
-// Loads one exam file, sets student_id, and resets question state.
-void load_exam(SharedData *data, const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        perror("fopen exam");
-        data->student_id = -1;
-    } else {
-        char line[64];
-        if (fgets(line, sizeof(line), f)) {
-            line[strcspn(line, "\r\n")] = '\0';
-            data->student_id = atoi(line);
-        } else {
-            data->student_id = -1;
+    for (int s = 0; s < exam_slots; s++) {
+        ExamSlot *slot = &data->exams[s];
+        if (atomic_load(&slot->exam_index) >= 0) {
+            atomic_ullong *words = num_questions <= FAST_QUESTIONS ? &slot->claimed
+                                                                   : claim_words(data, slot);
+            for (int w = 0; w < data->mask_words; w++) {
+                atomic_store(&words[w], policy == POLICY_STEAL ? full_word(w) : 0);
+            }
+
+            int marked = 0;
+            atomic_store(&slot->done, 0);
+            if (num_questions > FAST_QUESTIONS) {
+                for (int w = 0; w < data->mask_words; w++) {
+                    atomic_store(&done_words(data, slot)[w], 0);
+                }
+            }
+            for (int q = 0; q < num_questions; q++) {
+                Lease *l = question_lease(data, slot, q);
+                atomic_store(&l->ta, 0);
+                if (!atomic_load(&l->done)) {
+                    if (policy == POLICY_STEAL) {
+                        deque_push(ta_deque(s % num_tas), s * num_questions + q);
+                    }
+                    continue;
+                }
+
+                marked++;
+                complete_question(data, slot, q);
+                if (policy != POLICY_STEAL) {
+                    atomic_fetch_or(&words[q / 64], 1ULL << (q % 64));
+                }
+            }
+
+            if (marked == num_questions) {
+                clear_slot(data, slot);
+            } else {
+                kept += marked;
+                slot->loaded_us = now_us(); // latency restarts with this run
+            }
+        }
+
+        if (atomic_load(&slot->exam_index) < 0) {
+            fill_slot(data, slot, s % num_tas, NULL);
         }
-        fclose(f);
     }
+    return kept;
+}
 
-    for (int i = 0; i < MAX_QUESTIONS; i++) {
-        data->questions_marked[i] = 0;
+// Syncs the region to the state file. The file is the live region, so a
+// killed run leaves whatever the processes last wrote there anyway; a
+// sync only bounds what an OS crash can lose. Nothing is paused for it,
+// so the file can hold a transition or edit partway done, and
+// reset_state and resume_slots repair that on resume.
+void checkpoint_state(SharedData *data) {
+    long long start = wall_us();
+    if (msync(data, data->map_size, MS_SYNC) != 0) {
+        perror("msync state");
+    }
+    long long took = wall_us() - start;
+    data->checkpoints++;
+    if (took > data->checkpoint_us_max) {
+        data->checkpoint_us_max = took;
     }
 }
 
-/* ---------------- TA process (synchronized) ---------------- */
+// Background checkpointer for --state: a sync every CHECKPOINT_MS, and a
+// last one once main has reaped the TAs.
+void checkpoint_process(SharedData *data) {
+    while (!data->tas_exited) {
+        usleep(CHECKPOINT_MS * 1000);
+        checkpoint_state(data);
+    }
+    checkpoint_state(data);
+}
 
-void ta_process(int ta_id, SharedData *data) {
-    srand(time(NULL) + ta_id * 1000);
+/* ---------------- timer wheel event loop ---------------- */
 
-    printf("TA %d: Started\n", ta_id);
-    fflush(stdout);
+// Hashed timer wheel: one list of TAs per WHEEL_TICK_US tick, WHEEL_SLOTS
+// ticks around. Scheduling and firing a TA are O(1), so one loop can drive
+// tens of thousands of TAs; a TA due more than one turn ahead just stays
+// in its slot until its turn comes round.
+#define WHEEL_SLOTS    4096   // power of two
+#define WHEEL_TICK_US  1000   // 1 ms per slot
 
-    while (!data->finished) {
+typedef struct {
+    int        head[WHEEL_SLOTS];         // first TA in each slot, -1 = empty
+    int        tail[WHEEL_SLOTS];         // last TA, so a slot fires in FIFO order
+    int       *next;                      // next TA in the same slot
+    long long *due_tick;                  // tick each TA is due at
+    long long  cursor;                    // next tick to fire
+    int        pending;                   // TAs scheduled on the wheel
+} TimerWheel;
 
-        /* ----- RUBRIC SECTION (synchronized) ----- */
+int wheel_init(TimerWheel *w, int count, long long start_tick) {
+    for (int i = 0; i < WHEEL_SLOTS; i++) {
+        w->head[i] = w->tail[i] = -1;
+    }
+    w->next = malloc(sizeof(int) * count);
+    w->due_tick = malloc(sizeof(long long) * count);
+    w->cursor = start_tick;
+    w->pending = 0;
+    return (w->next && w->due_tick) ? 0 : -1;
+}
 
-        sem_wait(&data->rubric_sem);
-        printf("TA %d: Reviewing rubric\n", ta_id);
-        fflush(stdout);
+void wheel_free(TimerWheel *w) {
+    free(w->next);
+    free(w->due_tick);
+}
 
-        for (int i = 0; i < MAX_RUBRIC_LINES; i++) {
-            usleep(random_delay(500, 1000)); // 0.5–1s
+// Schedules TA i at `tick`, never earlier than the next tick to fire.
+void wheel_add(TimerWheel *w, int i, long long tick) {
+    if (tick < w->cursor) {
+        tick = w->cursor;
+    }
+    int slot = tick & (WHEEL_SLOTS - 1);
 
-            // 20% chance this TA decides to correct the rubric line
-            if (rand() % 100 < 20) {
-                char *comma = strchr(data->rubric[i], ',');
-                if (comma != NULL && comma[1] != '\0') {
-                    char old_char = comma[1];
-                    comma[1] = old_char + 1;
+    w->due_tick[i] = tick;
+    w->next[i] = -1;
+    if (w->tail[slot] == -1) {
+        w->head[slot] = i;
+    } else {
+        w->next[w->tail[slot]] = i;
+    }
+    w->tail[slot] = i;
+    w->pending++;
+}
 
-                    printf("TA %d: Modified rubric line %d: '%c' -> '%c'\n",
-                           ta_id, i + 1, old_char, comma[1]);
-                    fflush(stdout);
+// First tick at or after the cursor with something in its slot.
+long long wheel_next_tick(TimerWheel *w) {
+    for (long long t = w->cursor; t < w->cursor + WHEEL_SLOTS; t++) {
+        if (w->head[t & (WHEEL_SLOTS - 1)] != -1) return t;
+    }
+    return w->cursor + WHEEL_SLOTS;
+}
 
-                    // save the updated rubric to file while holding rubric_sem
-                    save_rubric(data, "rubric.txt");
-                }
+// Runs a group of TAs on the calling thread until all of them stop. Each
+// step's delay becomes a timer instead of a blocking sleep. TAs waiting
+// for work are parked off the wheel until work_seq moves on.
+void run_ta_loop(SharedData *data, TaState *tas, int count) {
+    TimerWheel *w = malloc(sizeof(TimerWheel));
+    int *parked = malloc(sizeof(int) * count);
+    if (!w || !parked || wheel_init(w, count, now_us() / WHEEL_TICK_US) != 0) {
+        perror("malloc wheel");
+        exit(1);
+    }
+    int num_parked = 0;
+    unsigned int parked_seq = 0;          // work_seq seen by the first TA parked
+
+    for (int i = 0; i < count; i++) {
+        ta_log(data, tas[i].id, EV_STARTED, -1, 0, 0, 0);
+        wheel_add(w, i, w->cursor);
+    }
+
+    while (w->pending > 0 || num_parked > 0) {
+        // new work since the parked TAs looked: they all run on the next tick
+        if (num_parked > 0 && atomic_load(&data->work_seq) != parked_seq) {
+            for (int k = 0; k < num_parked; k++) {
+                wheel_add(w, parked[k], w->cursor);
             }
+            num_parked = 0;
         }
 
-        printf("TA %d: Finished reviewing rubric\n", ta_id);
-        fflush(stdout);
-        sem_post(&data->rubric_sem);
+        // sleep until the next non-empty tick, or in virtual time just
+        // move the clock there: events then run in a fixed order
+        long long next_us = wheel_next_tick(w) * WHEEL_TICK_US;
+        if (virtual_time) {
+            if (next_us > virtual_now) {
+                virtual_now = next_us;
+            }
+        } else if (next_us > now_us()) {
+            if (num_parked > 0) {
+                wait_for_work(data, parked_seq, next_us - now_us()); // woken early by new work
+            } else {
+                usleep(next_us - now_us());
+            }
+        }
 
-        /* ----- QUESTION SELECTION SECTION (synchronized) ----- */
+        // fire every tick that is now in the past
+        long long now_tick = now_us() / WHEEL_TICK_US;
+        while (w->cursor <= now_tick) {
+            int slot = w->cursor & (WHEEL_SLOTS - 1);
+            int i = w->head[slot];
+            w->head[slot] = w->tail[slot] = -1;
+            w->cursor++; // anything re-added lands on a later tick
 
-        int q_chosen = -1;
+            while (i != -1) {
+                int next = w->next[i];
+                w->pending--;
 
-        sem_wait(&data->questions_sem);
-        for (int attempt = 0; attempt < 10; attempt++) {
-            int q = rand() % MAX_QUESTIONS;
-            if (data->questions_marked[q] == 0) {
-                // reserve this question
-                data->questions_marked[q] = 1;
-                q_chosen = q;
-                break;
+                if (w->due_tick[i] > w->cursor - 1) {
+                    // due on a later turn of the wheel
+                    wheel_add(w, i, w->due_tick[i]);
+                } else {
+                    long delay = ta_step(&tas[i], data);
+                    if (delay == STEP_WAIT_WORK) {
+                        // a TA that saw a newer work_seq is woken with the rest
+                        if (num_parked == 0) {
+                            parked_seq = tas[i].work_seq;
+                        }
+                        parked[num_parked++] = i;
+                    } else if (delay >= 0) {
+                        wheel_add(w, i, (now_us() + delay) / WHEEL_TICK_US);
+                    }
+                }
+                i = next;
             }
         }
-        sem_post(&data->questions_sem);
+    }
 
-        if (q_chosen != -1) {
-            printf("TA %d: Marking question %d for student %d\n",
-                   ta_id, q_chosen + 1, data->student_id);
-            fflush(stdout);
+    wheel_free(w);
+    free(w);
+    free(parked);
+}
 
-            // 1–2s marking time (no need to hold a lock during the sleep)
-            usleep(random_delay(1000, 2000));
+// Thread mode (--threads N): TAs are dealt out to N worker threads and
+// each worker runs its own timer wheel loop.
+typedef struct {
+    pthread_t thread;
+    SharedData *data;
+    TaState *tas;                         // this worker's TAs
+    int count;
+} TaWorker;
 
-            printf("TA %d: Finished marking question %d for student %d\n",
-                   ta_id, q_chosen + 1, data->student_id);
-            fflush(stdout);
-        }
+void *ta_worker(void *arg) {
+    TaWorker *w = arg;
+    run_ta_loop(w->data, w->tas, w->count);
+    return NULL;
+}
+
+// Runs every TA on num_threads threads inside this process and waits for
+// them. num_threads = 0 runs one event loop on the calling thread
+// (--event, and always in --virtual). Returns 0 on success.
+int run_ta_threads(SharedData *data, int num_threads) {
+    TaState *tas = calloc(num_tas, sizeof(TaState));
+    char *texts = malloc((size_t)num_tas * data->rubric_len);
+    if (!tas || !texts) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < num_tas; i++) {
+        ta_init(&tas[i], i + 1, texts + (size_t)i * data->rubric_len);
+    }
 
-        /* ----- CHECK IF EXAM IS DONE ----- */
+    if (num_threads == 0) {
+        run_ta_loop(data, tas, num_tas);
+        free(texts);
+        free(tas);
+        return 0;
+    }
 
-        // First, check under questions_sem if all questions are marked
-        int all_marked = 1;
-        sem_wait(&data->questions_sem);
-        for (int i = 0; i < MAX_QUESTIONS; i++) {
-            if (data->questions_marked[i] == 0) {
-                all_marked = 0;
-                break;
-            }
+    TaWorker *workers = calloc(num_threads, sizeof(TaWorker));
+    if (!workers) {
+        perror("calloc");
+        return 1;
+    }
+
+    // contiguous blocks of TAs per worker
+    int next_ta = 0;
+    for (int t = 0; t < num_threads; t++) {
+        TaWorker *w = &workers[t];
+        w->data = data;
+        w->count = num_tas / num_threads + (t < num_tas % num_threads);
+        w->tas = &tas[next_ta];
+        next_ta += w->count;
+
+        if (pthread_create(&w->thread, NULL, ta_worker, w) != 0) {
+            perror("pthread_create");
+            return 1;
         }
-        sem_post(&data->questions_sem);
+    }
 
-        if (all_marked) {
-            // Protect exam transitions so only one TA loads the next exam
-            sem_wait(&data->exam_sem);
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
 
-            // Re-check under exam_sem + questions_sem (in case of race)
-            sem_wait(&data->questions_sem);
-            all_marked = 1;
-            for (int i = 0; i < MAX_QUESTIONS; i++) {
-                if (data->questions_marked[i] == 0) {
-                    all_marked = 0;
-                    break;
-                }
-            }
-            sem_post(&data->questions_sem);
+    free(workers);
+    free(texts);
+    free(tas);
+    return 0;
+}
 
-            if (all_marked) {
-                int current_student = data->student_id;
+/* ---------------- main ---------------- */
 
-                printf("TA %d: All questions marked for student %d\n",
-                       ta_id, current_student);
-                fflush(stdout);
+// Prints per-TA task and steal counts for --policy steal.
+void print_steal_stats(void) {
+    int seeded = 0, steals = 0, misses = 0;
 
-                if (current_student == 9999) {
-                    // stop condition
-                    printf("TA %d: Reached student 9999, finishing\n", ta_id);
-                    fflush(stdout);
-                    data->finished = 1;
-                    sem_post(&data->exam_sem);
-                    break;
-                }
+    printf("Work stealing:\n  TA  seeded  tasks  steals  misses\n");
+    for (int i = 0; i < num_tas; i++) {
+        TaskDeque *dq = ta_deque(i);
+        seeded += dq->seeded;
+        steals += dq->steals;
+        misses += dq->steal_misses;
+        if (num_tas <= 32) {
+            printf("  %2d  %6d  %5d  %6d  %6d\n", i + 1, dq->seeded,
+                   ta_stats[i].questions, dq->steals, dq->steal_misses);
+        }
+    }
+    printf("  total: %d tasks seeded, %d stolen, %d empty steal rounds\n",
+           seeded, steals, misses);
+}
 
-                // move to next exam
-                data->current_exam_index++;
-                if (data->current_exam_index >= NUM_EXAMS) {
-                    data->finished = 1;
-                    sem_post(&data->exam_sem);
-                    break;
-                }
+// Idle is whatever part of the makespan a TA spent neither reviewing,
+// marking nor waiting for the exam lock (rubric lock waits are part of review).
+long long ta_idle_us(TaStats *st, long long makespan_us) {
+    return makespan_us - st->review_us - st->mark_us - st->exam_wait_us;
+}
 
-                load_exam(data, exam_files[data->current_exam_index]);
-                printf("TA %d: Moving to next exam (student %d)\n",
-                       ta_id, data->student_id);
-                fflush(stdout);
-            }
+// Prints makespan and per-TA utilisation and lock waits.
+void print_schedule_stats(long long makespan_us) {
+    long long total_idle = 0, rubric_wait = 0, exam_wait = 0;
+    int retries = 0;
+    int show_each = num_tas <= 32;
 
-            sem_post(&data->exam_sem);
+    printf("Policy %s: makespan %.2f s\n", policy_names[policy], makespan_us / 1e6);
+    if (show_each) {
+        printf("  TA  questions  review(s)  mark(s)  idle(s)  rubric wait(ms)  exam wait(ms)  claim retries\n");
+    }
+    for (int i = 0; i < num_tas; i++) {
+        TaStats *st = &ta_stats[i];
+        long long idle = ta_idle_us(st, makespan_us);
+        total_idle += idle;
+        rubric_wait += st->rubric_wait_us;
+        exam_wait += st->exam_wait_us;
+        retries += st->claim_retries;
+        if (show_each) {
+            printf("  %2d  %9d  %9.2f  %7.2f  %7.2f  %15.1f  %13.1f  %13d\n", i + 1, st->questions,
+                   st->review_us / 1e6, st->mark_us / 1e6, idle / 1e6,
+                   st->rubric_wait_us / 1e3, st->exam_wait_us / 1e3, st->claim_retries);
         }
+    }
+    printf("  total TA idle %.2f s (%.1f%% of TA time)\n", total_idle / 1e6,
+           makespan_us ? 100.0 * total_idle / ((double)makespan_us * num_tas) : 0.0);
+    printf("  total lock waits: rubric_sem %.1f ms, exam_sem %.1f ms; %d claim retries\n",
+           rubric_wait / 1e3, exam_wait / 1e3, retries);
+}
+
+// One histogram summary line: count, mean and percentiles.
+void print_histogram(const char *name, Histogram *h) {
+    long long count = atomic_load(&h->count);
+    printf("  %-13s n=%-7lld mean %9.1f ms  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f\n",
+           name, count, count ? atomic_load(&h->sum_us) / 1e3 / count : 0.0,
+           hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+           hist_percentile(h, 99) / 1e3, atomic_load(&h->max_us) / 1e3);
+}
+
+void json_histogram(FILE *f, const char *name, Histogram *h) {
+    fprintf(f, "    \"%s\": {\"count\": %lld, \"sum_us\": %lld, \"max_us\": %lld, "
+               "\"p50_us\": %lld, \"p90_us\": %lld, \"p99_us\": %lld, \"p999_us\": %lld, \"buckets\": [",
+            name, atomic_load(&h->count), atomic_load(&h->sum_us), atomic_load(&h->max_us),
+            hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99),
+            hist_percentile(h, 99.9));
 
-        usleep(50000); // small delay so output isn't too spammy
+    // only non-empty buckets, as [upper bound, count] pairs
+    int first = 1;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        long long n = atomic_load(&h->buckets[b]);
+        if (n == 0) continue;
+        fprintf(f, "%s[%lld, %lld]", first ? "" : ", ", hist_bucket_max(b), n);
+        first = 0;
     }
+    fprintf(f, "]}");
+}
 
-    printf("TA %d: Stopped\n", ta_id);
-    fflush(stdout);
+// --json: every metric in one machine-readable file.
+int write_metrics_json(SharedData *data, const char *path, long long makespan_us) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("fopen json");
+        return 1;
+    }
+
+    int retries = 0;
+    for (int i = 0; i < num_tas; i++) {
+        retries += ta_stats[i].claim_retries;
+    }
+
+    fprintf(f, "{\n  \"tas\": %d,\n  \"policy\": \"%s\",\n  \"in_flight\": %d,\n"
+               "  \"questions\": %d,\n  \"rubric_lines\": %d,\n  \"delay_scale\": %g,\n"
+               "  \"seed\": %llu,\n  \"virtual\": %d,\n  \"makespan_us\": %lld,\n"
+               "  \"exams\": %d,\n  \"claim_retries\": %d,\n  \"respawns\": %d,\n",
+            num_tas, policy_names[policy], exam_slots, num_questions, data->rubric_lines, delay_scale,
+            (unsigned long long)run_seed, virtual_time, makespan_us, data->transitions, retries,
+            data->respawns);
+
+    fprintf(f, "  \"per_ta\": [\n");
+    for (int i = 0; i < num_tas; i++) {
+        TaStats *st = &ta_stats[i];
+        fprintf(f, "    {\"ta\": %d, \"questions\": %d, \"review_us\": %lld, \"mark_us\": %lld, "
+                   "\"idle_us\": %lld, \"rubric_wait_us\": %lld, \"exam_wait_us\": %lld, "
+                   "\"claim_retries\": %d, \"work_waits\": %d}%s\n",
+                i + 1, st->questions, st->review_us, st->mark_us, ta_idle_us(st, makespan_us),
+                st->rubric_wait_us, st->exam_wait_us, st->claim_retries, st->work_waits,
+                i + 1 < num_tas ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"histograms\": {\n");
+    json_histogram(f, "exam_latency", &data->exam_latency);
+    fprintf(f, ",\n");
+    json_histogram(f, "rubric_wait", &data->rubric_wait);
+    fprintf(f, ",\n");
+    json_histogram(f, "exam_wait", &data->exam_wait);
+    fprintf(f, "\n  }\n}\n");
+
+    if (fclose(f) != 0) {
+        perror("write json");
+        return 1;
+    }
+    return 0;
 }
 
-/* ---------------- main ---------------- */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d exam_dir | -s exam_store] [-w] [-p policy] [-n in_flight] [-S seed]\n"
+                    "          [-q questions] [-x delay_scale] [-C crash_pct] [-L lease_ms]\n"
+                    "          [-F state_file [-R | -O]]\n"
+                    "          [-t threads | -e | -V] [-l log_file] [-j json_file] <number_of_TAs>\n"
+                    "       %s --log-dump log_file\n", prog, prog);
+    fprintf(stderr, "Policies:");
+    for (int i = 0; i < NUM_POLICIES; i++) {
+        fprintf(stderr, " %s", policy_names[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+// Finds a policy by name. Returns -1 if the name is unknown.
+int parse_policy(const char *name) {
+    for (int i = 0; i < NUM_POLICIES; i++) {
+        if (strcmp(name, policy_names[i]) == 0) return i;
+    }
+    return -1;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <number_of_TAs>\n", argv[0]);
+    const char *exam_dir = "exams";
+    const char *store_path = NULL;
+    int num_threads = 0; // 0 = fork one process per TA
+    int event_loop = 0;  // 1 = every TA on one event loop (--event)
+    const char *log_path = NULL; // binary event log instead of text (--log-binary)
+    const char *json_path = NULL; // metrics dump (--json)
+    const char *state_path = NULL; // file backing the shared region (--state)
+    int resume = 0;      // 1 = continue the run saved in state_path (--resume)
+    int overwrite = 0;   // 1 = start afresh over a run saved there (--overwrite)
+
+    static const struct option long_opts[] = {
+        {"exam-dir", required_argument, NULL, 'd'},
+        {"store",    required_argument, NULL, 's'},
+        {"write-behind", no_argument,   NULL, 'w'},
+        {"policy",   required_argument, NULL, 'p'},
+        {"threads",  required_argument, NULL, 't'},
+        {"event",    no_argument,       NULL, 'e'},
+        {"virtual",  no_argument,       NULL, 'V'},
+        {"in-flight", required_argument, NULL, 'n'},
+        {"seed",     required_argument, NULL, 'S'},
+        {"log-binary", required_argument, NULL, 'l'},
+        {"log-dump", required_argument, NULL, 'D'},
+        {"json",     required_argument, NULL, 'j'},
+        {"questions", required_argument, NULL, 'q'},
+        {"delay-scale", required_argument, NULL, 'x'},
+        {"crash",    required_argument, NULL, 'C'},
+        {"lease-ms", required_argument, NULL, 'L'},
+        {"state",    required_argument, NULL, 'F'},
+        {"resume",   no_argument,       NULL, 'R'},
+        {"overwrite", no_argument,      NULL, 'O'},
+        {NULL, 0, NULL, 0}
+    };
+
+    run_seed = (uint64_t)time(NULL);
+    main_pid = getpid();
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:s:wp:t:eVn:S:l:D:j:q:x:C:L:F:RO", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            exam_dir = optarg;
+            break;
+        case 's':
+            store_path = optarg;
+            break;
+        case 'w':
+            write_behind = 1;
+            break;
+        case 'p':
+            if (parse_policy(optarg) < 0) {
+                fprintf(stderr, "Unknown policy '%s'\n", optarg);
+                usage(argv[0]);
+                return 1;
+            }
+            policy = parse_policy(optarg);
+            break;
+        case 't':
+            num_threads = atoi(optarg);
+            if (num_threads < 1) {
+                fprintf(stderr, "Number of threads must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'e':
+            event_loop = 1;
+            break;
+        case 'V':
+            virtual_time = 1;
+            break;
+        case 'S':
+            run_seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'l':
+            log_path = optarg;
+            break;
+        case 'D':
+            return dump_log_file(optarg);
+        case 'j':
+            json_path = optarg;
+            break;
+        case 'q':
+            num_questions = atoi(optarg);
+            if (num_questions < 1 || num_questions > MAX_QUESTIONS) {
+                fprintf(stderr, "Questions per exam must be 1-%d\n", MAX_QUESTIONS);
+                return 1;
+            }
+            break;
+        case 'x':
+            delay_scale = atof(optarg);
+            if (delay_scale <= 0) {
+                fprintf(stderr, "Delay scale must be positive\n");
+                return 1;
+            }
+            break;
+        case 'C':
+            crash_rate = atoi(optarg);
+            if (crash_rate < 0 || crash_rate > 100) {
+                fprintf(stderr, "Crash rate must be 0-100 percent\n");
+                return 1;
+            }
+            break;
+        case 'L':
+            lease_ms = atoi(optarg);
+            if (lease_ms <= MARK_MIN_MS) {
+                // shorter leases expire before any mark can finish
+                fprintf(stderr, "Lease must be longer than %d ms\n", MARK_MIN_MS);
+                return 1;
+            }
+            break;
+        case 'F':
+            state_path = optarg;
+            break;
+        case 'R':
+            resume = 1;
+            break;
+        case 'O':
+            overwrite = 1;
+            break;
+        case 'n':
+            exam_slots = atoi(optarg);
+            if (exam_slots < 1 || exam_slots > MAX_EXAM_SLOTS) {
+                fprintf(stderr, "Exams in flight must be 1-%d\n", MAX_EXAM_SLOTS);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(argv[0]);
         return 1;
     }
 
-    int num_tas = atoi(argv[1]);
+    num_tas = atoi(argv[optind]);
     if (num_tas < 2) {
         fprintf(stderr, "Number of TAs must be at least 2\n");
         return 1;
     }
 
-    printf("Starting Part 2.b with %d TAs (with semaphores)\n", num_tas);
-    fflush(stdout);
+    if ((resume || overwrite) && !state_path) {
+        fprintf(stderr, "--resume and --overwrite need --state\n");
+        return 1;
+    }
+    if (resume && overwrite) {
+        fprintf(stderr, "--resume and --overwrite can't be used together\n");
+        return 1;
+    }
 
-    // shared memory for SharedData
-    SharedData *data = mmap(NULL, sizeof(SharedData),
-                            PROT_READ | PROT_WRITE,
-                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    if (data == MAP_FAILED) {
-        perror("mmap");
+    if (num_threads > num_tas) {
+        num_threads = num_tas;
+    }
+
+    if (crash_rate > 0 && (virtual_time || event_loop || num_threads > 0)) {
+        // a crash would take every TA in the process down with it
+        fprintf(stderr, "--crash needs one process per TA (no -t, -e or -V)\n");
         return 1;
     }
 
-    memset(data, 0, sizeof(SharedData));
-    data->current_exam_index = 0;
-    data->finished = 0;
+    int state_fd = -1;
+    if (state_path) {
+        state_fd = open(state_path, resume ? O_RDWR : O_RDWR | O_CREAT, 0644);
+        if (state_fd < 0) {
+            perror("open state");
+            return 1;
+        }
+        if (!resume) {
+            // a saved run is only thrown away when asked to
+            if (!overwrite && holds_saved_run(state_fd)) {
+                fprintf(stderr, "%s holds a saved run: -R to resume it, -O to start over\n",
+                        state_path);
+                return 1;
+            }
+            if (ftruncate(state_fd, 0) != 0) {
+                perror("truncate state");
+                return 1;
+            }
+        }
+    }
+
+    if (virtual_time) {
+        // one deterministic event loop; rubric.txt writes would dominate
+        // a simulated run, so they go through the flusher
+        event_loop = 1;
+        write_behind = 1;
+        num_threads = 0;
+        printf("Starting Part 2.b with %d TAs in virtual time (%s policy, write-behind rubric)\n",
+               num_tas, policy_names[policy]);
+    } else if (event_loop) {
+        num_threads = 0;
+        printf("Starting Part 2.b with %d TAs on one event loop (with semaphores, %s policy)\n",
+               num_tas, policy_names[policy]);
+    } else if (num_threads > 0) {
+        printf("Starting Part 2.b with %d TAs on %d threads (with semaphores, %s policy)\n",
+               num_tas, num_threads, policy_names[policy]);
+    } else {
+        printf("Starting Part 2.b with %d TAs (with semaphores, %s policy)\n",
+               num_tas, policy_names[policy]);
+    }
+    fflush(stdout);
+
+    SharedData *data;
+    char **rubric_lines = NULL;
+    if (resume) {
+        // shape, rubric and progress all come from the state file
+        data = map_state_file(state_fd, state_path);
+        if (!data) {
+            return 1;
+        }
+        reset_state(data);
+    } else {
+        // the rubric file decides the shape of the shared region
+        int rubric_max_len;
+        int rubric_count = read_rubric_file("rubric.txt", &rubric_lines, &rubric_max_len);
+        if (rubric_count == 0) {
+            fprintf(stderr, "rubric.txt has no lines\n");
+            return 1;
+        }
+
+        // shared memory for SharedData and its variable-length parts
+        data = map_shared_data(rubric_count, rubric_max_len + 1, state_fd);
+        if (!data) {
+            return 1;
+        }
+
+        data->next_exam_index = 0;
+        data->finished = 0;
+    }
+    if (state_fd >= 0) {
+        close(state_fd); // the mapping keeps the file
+    }
 
     // init semaphores (pshared = 1 so they are shared between processes)
-    sem_init(&data->rubric_sem,    1, 1);
-    sem_init(&data->questions_sem, 1, 1);
-    sem_init(&data->exam_sem,      1, 1);
+    if (lock_table_init(&data->locks, num_tas, 0) != 0 ||
+        lock_add(&data->locks, "rubric_sem") != RUBRIC_LOCK ||
+        lock_add(&data->locks, "exam_sem") != EXAM_LOCK) {
+        fprintf(stderr, "lock table setup failed\n");
+        return 1;
+    }
+    sem_init(&data->loader_free,   1, LOADER_QUEUE);
+    sem_init(&data->loader_ready,  1, 0);
 
-    // load rubric and first exam into shared memory
-    load_rubric(data, "rubric.txt");
+    // load rubric into shared memory
+    if (!resume) {
+        install_rubric(data, rubric_lines);
+    }
+    printf("Seed: %llu (rerun with --seed %llu)\n",
+           (unsigned long long)run_seed, (unsigned long long)run_seed);
+    printf("Shape: %d questions per exam (%s claims), %d rubric lines of up to %d chars\n",
+           num_questions, num_questions <= FAST_QUESTIONS ? "single-word" : "multi-word",
+           data->rubric_lines, data->rubric_len - 1);
     printf("Rubric loaded:\n");
-    for (int i = 0; i < MAX_RUBRIC_LINES; i++) {
-        printf("  %s\n", data->rubric[i]);
+    for (int i = 0; i < data->rubric_lines; i++) {
+        printf("  %s\n", rubric_line(data, i)->text);
     }
     fflush(stdout);
 
-    load_exam(data, exam_files[data->current_exam_index]);
-    printf("First exam loaded: student %d\n", data->student_id);
+    // index the exam directory (or map the store) once; TAs inherit it
+    struct timespec scan_start, scan_end;
+    clock_gettime(CLOCK_MONOTONIC, &scan_start);
+    if (store_path) {
+        if (open_exam_store(store_path, &exam_store) != 0) {
+            return 1;
+        }
+    } else if (scan_exam_dir(exam_dir, &exam_list) != 0) {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &scan_end);
+    printf("Indexed %d exams from %s in %.1f ms\n", total_exams(),
+           store_path ? store_path : exam_dir,
+           (scan_end.tv_sec - scan_start.tv_sec) * 1e3 +
+           (scan_end.tv_nsec - scan_start.tv_nsec) / 1e6);
+    if (!resume) {
+        data->num_exams = total_exams();
+    } else if (data->num_exams != total_exams()) {
+        // resume_exam is a position in the exam list, so it must be the same list
+        fprintf(stderr, "%s was written for %d exams, found %d\n",
+                state_path, data->num_exams, total_exams());
+        return 1;
+    }
+
+    // start the loader so exams are parsed before anyone needs them
+    fflush(stdout); // children must not inherit buffered output
+    pid_t loader_pid = fork();
+    if (loader_pid < 0) {
+        perror("fork loader");
+        return 1;
+    } else if (loader_pid == 0) {
+        die_with_parent();
+        loader_process(data);
+        exit(0);
+    }
+
+    ta_stats = mmap(NULL, sizeof(TaStats) * num_tas, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ta_stats == MAP_FAILED) {
+        perror("mmap ta_stats");
+        return 1;
+    }
+    memset(ta_stats, 0, sizeof(TaStats) * num_tas);
+
+    // every task of every in-flight exam fits in any one deque
+    deque_size = 64;
+    while (deque_size < exam_slots * num_questions) {
+        deque_size *= 2;
+    }
+    deque_stride = align_up(sizeof(TaskDeque) + deque_size * sizeof(atomic_int), CACHE_LINE);
+    // one more deque for the supervisor's reclaimed tasks
+    deques = mmap(NULL, deque_stride * (num_tas + 1), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (deques == MAP_FAILED) {
+        perror("mmap deques");
+        return 1;
+    }
+    memset(deques, 0, deque_stride * (num_tas + 1));
+
+    log_rings = mmap(NULL, sizeof(LogRing) * num_tas, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (log_rings == MAP_FAILED) {
+        perror("mmap log rings");
+        return 1;
+    }
+    memset(log_rings, 0, sizeof(LogRing) * num_tas);
+
+    if (log_path) {
+        log_binary = fopen(log_path, "wb");
+        if (!log_binary) {
+            perror("fopen log");
+            return 1;
+        }
+        LogFileHeader hdr = { .version = LOG_FILE_VERSION, .record_size = sizeof(LogRecord) };
+        memcpy(hdr.magic, LOG_FILE_MAGIC, 4);
+        fwrite(&hdr, sizeof(hdr), 1, log_binary);
+        fflush(log_binary);
+    }
+
+    // fill every exam slot before the TAs start (steal mode: spread the
+    // first exams' tasks over the TAs' deques)
+    if (resume) {
+        int kept = resume_slots(data);
+        printf("Resumed from %s: %d of %d exams taken, %d in flight with %d questions already marked\n",
+               state_path, data->resume_exam, total_exams(), slots_in_flight(data), kept);
+    } else {
+        // all empty first: fill_slot looks for its exam in every slot
+        for (int s = 0; s < exam_slots; s++) {
+            clear_slot(data, &data->exams[s]);
+        }
+        for (int s = 0; s < exam_slots; s++) {
+            if (fill_slot(data, &data->exams[s], s % num_tas, NULL)) {
+                printf("Exam loaded into slot %d: student %d\n",
+                       s, data->exams[s].student_id);
+            }
+        }
+    }
+    if (slots_in_flight(data) == 0) {
+        data->finished = 1;
+    }
     fflush(stdout);
 
-    // fork TA processes
+    // setup is complete: from here on the state file can be resumed
+    memcpy(data->magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    data->version = STATE_VERSION;
+
+    pid_t checkpoint_pid = -1;
+    if (state_path) {
+        checkpoint_pid = fork();
+        if (checkpoint_pid < 0) {
+            perror("fork checkpointer");
+            return 1;
+        } else if (checkpoint_pid == 0) {
+            die_with_parent();
+            checkpoint_process(data);
+            exit(0);
+        }
+    }
+
+    // start the rubric flusher for write-behind mode
+    pid_t flusher_pid = -1;
+    if (write_behind) {
+        flusher_pid = fork();
+        if (flusher_pid < 0) {
+            perror("fork flusher");
+            return 1;
+        } else if (flusher_pid == 0) {
+            die_with_parent();
+            flusher_process(data);
+            exit(0);
+        }
+    }
+
+    // start the log writer; TAs only append to their rings
+    pid_t writer_pid = fork();
+    if (writer_pid < 0) {
+        perror("fork log writer");
+        return 1;
+    } else if (writer_pid == 0) {
+        die_with_parent();
+        log_writer_process(data);
+        exit(0);
+    }
+
+    // fork TA processes (or run them on threads in this process)
     pid_t *pids = malloc(sizeof(pid_t) * num_tas);
     if (!pids) {
         perror("malloc");
         return 1;
     }
 
-    for (int i = 0; i < num_tas; i++) {
-        pids[i] = fork();
-        if (pids[i] < 0) {
-            perror("fork");
+    data->start_us = now_us();
+    long long wall_start = wall_us();
+
+    if (event_loop || num_threads > 0) {
+        if (run_ta_threads(data, num_threads) != 0) {
             return 1;
-        } else if (pids[i] == 0) {
-            ta_process(i + 1, data);
-            exit(0);
         }
+    } else {
+        for (int i = 0; i < num_tas; i++) {
+            pids[i] = fork();
+            if (pids[i] < 0) {
+                perror("fork");
+                return 1;
+            } else if (pids[i] == 0) {
+                die_with_parent();
+                ta_process(i + 1, data);
+                exit(0);
+            }
+        }
+
+        // parent waits for TAs, restarting any that die
+        supervise_tas(data, pids);
     }
+    long long makespan_us = now_us() - data->start_us;
+    long long wall_time_us = wall_us() - wall_start;
 
-    // parent waits for TAs
-    for (int i = 0; i < num_tas; i++) {
-        waitpid(pids[i], NULL, 0);
+    // the loader may be blocked on a full queue; wake it so it can exit
+    data->finished = 1;
+    data->tas_exited = 1;
+    sem_post(&data->loader_free);
+    waitpid(loader_pid, NULL, 0);
+    if (flusher_pid > 0) {
+        waitpid(flusher_pid, NULL, 0); // does the final flush before exiting
+    }
+    waitpid(writer_pid, NULL, 0);      // drains the last events before exiting
+    if (checkpoint_pid > 0) {
+        waitpid(checkpoint_pid, NULL, 0); // syncs the final state before exiting
     }
 
     printf("\nAll TAs finished\n");
     printf("Final rubric:\n");
-    for (int i = 0; i < MAX_RUBRIC_LINES; i++) {
-        printf("  %s\n", data->rubric[i]);
+    for (int i = 0; i < data->rubric_lines; i++) {
+        printf("  %s\n", rubric_line(data, i)->text);
+    }
+    if (write_behind) {
+        printf("Rubric: %u edits written in %d flushes\n",
+               atomic_load(&data->rubric_edits), data->rubric_flushes);
+    }
+    int attempts = atomic_load(&data->edit_attempts);
+    int conflicts = atomic_load(&data->edit_conflicts);
+    printf("Rubric edits: %d attempts, %d conflicts (%.1f%%), %d retried, %d dropped\n",
+           attempts, conflicts, attempts ? 100.0 * conflicts / attempts : 0.0,
+           conflicts - atomic_load(&data->edit_dropped), atomic_load(&data->edit_dropped));
+    print_schedule_stats(makespan_us);
+    printf("Latency histograms:\n");
+    print_histogram("exam latency", &data->exam_latency);
+    print_histogram("rubric_sem", &data->rubric_wait);
+    print_histogram("exam_sem", &data->exam_wait);
+    if (virtual_time) {
+        printf("Simulated makespan %.1f s in %.2f s of wall-clock time\n",
+               makespan_us / 1e6, wall_time_us / 1e6);
+    }
+    if (policy == POLICY_STEAL) {
+        print_steal_stats();
+    }
+    printf("Loader: %d exam transitions, TAs stalled on %d (%.1f ms waiting)\n",
+           data->transitions, data->loader_stalls, data->loader_stall_us / 1000.0);
+    int work_waits = 0;
+    for (int i = 0; i < num_tas; i++) {
+        work_waits += ta_stats[i].work_waits;
+    }
+    printf("Idle TAs: slept %d times with no free question, %d wakeups sent\n",
+           work_waits, atomic_load(&data->work_wakes));
+    printf("Leases: %d taken back from dead TAs, %d expired, %d late marks dropped; "
+           "%d TAs restarted, %d locks recovered from a dead holder\n",
+           atomic_load(&data->leases_dead), atomic_load(&data->leases_expired),
+           atomic_load(&data->leases_lost), data->respawns, lock_owner_deaths(&data->locks));
+    if (state_path) {
+        printf("State: %d checkpoints to %s (longest %.1f ms), resumed %d times\n",
+               data->checkpoints, state_path, data->checkpoint_us_max / 1000.0, data->resumes);
+    }
+    printf("Event log: TAs waited on a full ring %d times%s%s\n",
+           atomic_load(&data->log_rings_full), log_path ? ", written to " : "",
+           log_path ? log_path : "");
+    if (json_path && write_metrics_json(data, json_path, makespan_us) == 0) {
+        printf("Metrics written to %s\n", json_path);
     }
 
     // cleanup
-    sem_destroy(&data->rubric_sem);
-    sem_destroy(&data->questions_sem);
-    sem_destroy(&data->exam_sem);
-    munmap(data, sizeof(SharedData));
+    lock_table_destroy(&data->locks);
+    sem_destroy(&data->loader_free);
+    sem_destroy(&data->loader_ready);
+    munmap(ta_stats, sizeof(TaStats) * num_tas);
+    munmap(deques, deque_stride * (num_tas + 1));
+    munmap(log_rings, sizeof(LogRing) * num_tas);
+    if (log_binary) {
+        fclose(log_binary);
+    }
+    munmap(data, data->map_size);
+    free_exam_index(&exam_list);
+    close_exam_store(&exam_store);
     free(pids);
 
     return 0;
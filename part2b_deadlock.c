@@ -7,6 +7,9 @@
 #include <sys/mman.h>
 #include <semaphore.h>
 #include <time.h>
+#include <getopt.h>
+
+#include "locks.h"
 
 #define MAX_RUBRIC_LINES 5
 #define MAX_QUESTIONS 5
@@ -16,37 +19,55 @@ typedef struct {
     int questions_marked[MAX_QUESTIONS];
     int current_exam_num;
     int finished;
-    sem_t rubric_sem;      // Protects rubric access
-    sem_t questions_sem;   // Protects questions_marked array
-    sem_t exam_sem;        // Protects exam transitions
+    LockTable locks;       // rubric, questions and exam locks with holders/waiters
+    int rubric_lock;       // Protects rubric access
+    int questions_lock;    // Protects questions_marked array
+    int exam_lock;         // Protects exam transitions
 } SharedData;
 
+// How TAs take their two locks (set in main before forking).
+typedef enum {
+    MODE_ORDERED,   // one acquire set in the global lock order: no deadlock possible
+    MODE_DETECT,    // each path picks its own order; cycles detected and broken
+    MODE_NAIVE,     // each path picks its own order; a deadlock hangs the run
+} LockMode;
+
+LockMode mode = MODE_ORDERED;
+
 int random_delay(int min_ms, int max_ms) {
     return (rand() % (max_ms - min_ms + 1) + min_ms) * 1000;
 }
 
-void ta_process_deadlock(int ta_id, SharedData *data) {
-    srand(time(NULL) + ta_id * 1000);
-    int exams_to_process[] = {1, 2, 3, 9999};
-
-    printf("TA %d: Started\n", ta_id);
-    fflush(stdout);
+// Takes `first` then `second` and works with both. With detection on, a
+// TA picked as the victim of a cycle drops what it holds, backs off for
+// a random time and starts over; in --naive mode this can hang forever.
+// Built with -DLOCK_DEBUG, the even TAs' order aborts instead.
+void work_with_both(int ta_id, SharedData *data, int first, int second) {
+    LockTable *t = &data->locks;
+    int owner = ta_id - 1;
+    const char *first_name = t->locks[first].name;
+    const char *second_name = t->locks[second].name;
 
-    // DEADLOCK SCENARIO: Different lock acquisition order
-    if (ta_id % 2 == 1) {
-        // Odd TAs: acquire rubric first, then questions
-        printf("TA %d: Trying to acquire rubric lock first\n", ta_id);
+    for (;;) {
+        printf("TA %d: Trying to acquire %s lock first\n", ta_id, first_name);
         fflush(stdout);
-        sem_wait(&data->rubric_sem);
-        printf("TA %d: Acquired rubric lock\n", ta_id);
+        lock_acquire(t, first, owner); // holds nothing yet, so can't be a victim
+        printf("TA %d: Acquired %s lock\n", ta_id, first_name);
         fflush(stdout);
 
         usleep(100000);  // Delays to increase chance of deadlock
 
-        printf("TA %d: Trying to acquire questions lock\n", ta_id);
+        printf("TA %d: Trying to acquire %s lock\n", ta_id, second_name);
         fflush(stdout);
-        sem_wait(&data->questions_sem);
-        printf("TA %d: Acquired questions lock\n", ta_id);
+        if (lock_acquire(t, second, owner) == LOCK_DEADLOCK) {
+            printf("TA %d: Deadlock detected, releasing %s lock and backing off\n",
+                   ta_id, first_name);
+            fflush(stdout);
+            lock_release_all(t, owner);
+            usleep(random_delay(10, 100)); // random, so the retry doesn't collide again
+            continue;
+        }
+        printf("TA %d: Acquired %s lock\n", ta_id, second_name);
         fflush(stdout);
 
         // Do work
@@ -54,55 +75,108 @@ void ta_process_deadlock(int ta_id, SharedData *data) {
         fflush(stdout);
         usleep(random_delay(500, 1000));
 
-        sem_post(&data->questions_sem);
-        sem_post(&data->rubric_sem);
+        lock_release(t, second);
+        lock_release(t, first);
         printf("TA %d: Released both locks\n", ta_id);
         fflush(stdout);
-    } else {
-        // Even TAs: acquire questions first, then rubric
-        printf("TA %d: Trying to acquire questions lock first\n", ta_id);
-        fflush(stdout);
-        sem_wait(&data->questions_sem);
-        printf("TA %d: Acquired questions lock\n", ta_id);
-        fflush(stdout);
+        return;
+    }
+}
 
-        usleep(100000);  // Delays to increase chance of deadlock
+// Takes both locks as one set. Whichever the TA would have taken first,
+// the set is taken in the global order, so no two TAs can ever wait on
+// each other in a cycle and no timeouts are needed.
+void work_with_set(int ta_id, SharedData *data, int first) {
+    LockTable *t = &data->locks;
+    int owner = ta_id - 1;
+    LockSet both = LOCK_BIT(data->rubric_lock) | LOCK_BIT(data->questions_lock);
 
-        printf("TA %d: Trying to acquire rubric lock\n", ta_id);
-        fflush(stdout);
-        sem_wait(&data->rubric_sem);
-        printf("TA %d: Acquired rubric lock\n", ta_id);
-        fflush(stdout);
+    printf("TA %d: Wants %s lock first; acquiring rubric and questions locks as a set\n",
+           ta_id, t->locks[first].name);
+    fflush(stdout);
+    lock_acquire_set(t, both, owner);
+    printf("TA %d: Acquired both locks\n", ta_id);
+    fflush(stdout);
 
-        // Do work
-        printf("TA %d: Performing work with both locks\n", ta_id);
-        fflush(stdout);
-        usleep(random_delay(500, 1000));
+    // Do work
+    printf("TA %d: Performing work with both locks\n", ta_id);
+    fflush(stdout);
+    usleep(random_delay(500, 1000));
 
-        sem_post(&data->rubric_sem);
-        sem_post(&data->questions_sem);
-        printf("TA %d: Released both locks\n", ta_id);
-        fflush(stdout);
+    lock_release_set(t, both);
+    printf("TA %d: Released both locks\n", ta_id);
+    fflush(stdout);
+}
+
+void ta_process_deadlock(int ta_id, SharedData *data) {
+    srand(time(NULL) + ta_id * 1000);
+
+    printf("TA %d: Started\n", ta_id);
+    fflush(stdout);
+
+    if (mode == MODE_ORDERED) {
+        work_with_set(ta_id, data, ta_id % 2 == 1 ? data->rubric_lock : data->questions_lock);
+    } else if (ta_id % 2 == 1) {
+        // DEADLOCK SCENARIO: Different lock acquisition order
+        // Odd TAs: acquire rubric first, then questions
+        work_with_both(ta_id, data, data->rubric_lock, data->questions_lock);
+    } else {
+        // Even TAs: acquire questions first, then rubric
+        work_with_both(ta_id, data, data->questions_lock, data->rubric_lock);
     }
 
     printf("TA %d: Stopped\n", ta_id);
     fflush(stdout);
 }
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d | -n] <number_of_TAs>\n", prog);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <number_of_TAs>\n", argv[0]);
+    static const struct option long_opts[] = {
+        {"detect", no_argument, NULL, 'd'},
+        {"naive",  no_argument, NULL, 'n'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "dn", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            mode = MODE_DETECT;
+            break;
+        case 'n':
+            mode = MODE_NAIVE;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
         return 1;
     }
 
-    int num_tas = atoi(argv[1]);
-    if (num_tas < 2) {
-        fprintf(stderr, "Number of TAs must be at least 2\n");
+    int num_tas = atoi(argv[optind]);
+    if (num_tas < 2 || num_tas > LOCK_MAX_OWNERS) {
+        fprintf(stderr, "Number of TAs must be between 2 and %d\n", LOCK_MAX_OWNERS);
         return 1;
     }
 
     printf("Starting Part 2.b DEADLOCK DEMONSTRATION with %d TAs\n", num_tas);
-    printf("This version demonstrates a deadlock scenario with different lock acquisition orders.\n");
+    if (mode == MODE_ORDERED) {
+        printf("Every TA takes its locks as one set in the global order, so no deadlock can occur.\n");
+    } else {
+        printf("This version demonstrates a deadlock scenario with different lock acquisition orders.\n");
+    }
+    if (mode == MODE_DETECT) {
+        printf("Deadlock detection is on: a blocked TA checks for a wait-for cycle every %d ms.\n",
+               LOCK_CHECK_MS);
+    } else if (mode == MODE_NAIVE) {
+        printf("Deadlock detection is off (--naive): a deadlock hangs the run.\n");
+    }
     fflush(stdout);
 
     // Create shared memory
@@ -119,10 +193,13 @@ int main(int argc, char *argv[]) {
     memset(data, 0, sizeof(SharedData));
     data->finished = 0;
 
-    // Initialize semaphores (shared between processes)
-    sem_init(&data->rubric_sem, 1, 1);      // Binary semaphore
-    sem_init(&data->questions_sem, 1, 1);   // Binary semaphore
-    sem_init(&data->exam_sem, 1, 1);        // Binary semaphore
+    // Initialize locks (binary semaphores shared between processes)
+    if (lock_table_init(&data->locks, num_tas, mode == MODE_DETECT) != 0) {
+        return 1;
+    }
+    data->rubric_lock    = lock_add(&data->locks, "rubric");
+    data->questions_lock = lock_add(&data->locks, "questions");
+    data->exam_lock      = lock_add(&data->locks, "exam");
 
     // Fork TA processes
     pid_t pids[num_tas];
@@ -137,21 +214,44 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Wait for all TAs (will likely hang due to deadlock)
-    printf("\nWaiting for TAs to finish... (may hang if deadlock occurs)\n");
+    // Wait for all TAs (in --naive mode this will likely hang due to deadlock)
+    const char *outlook[] = {"no deadlock possible", "deadlocks are detected and broken",
+                             "may hang if deadlock occurs"};
+    printf("\nWaiting for TAs to finish... (%s)\n", outlook[mode]);
     fflush(stdout);
 
+    // a TA that died (e.g. a LOCK_DEBUG order abort) is not a clean finish
+    int failed = 0;
     for (int i = 0; i < num_tas; i++) {
-        waitpid(pids[i], NULL, 0);
+        int status;
+        waitpid(pids[i], &status, 0);
+        if (WIFSIGNALED(status)) {
+            printf("TA %d: killed by signal %d\n", i + 1, WTERMSIG(status));
+            failed++;
+        } else if (WEXITSTATUS(status) != 0) {
+            printf("TA %d: exited with status %d\n", i + 1, WEXITSTATUS(status));
+            failed++;
+        }
     }
 
-    printf("\nAll TAs finished (no deadlock occurred)\n");
+    LockTable *t = &data->locks;
+    if (failed > 0) {
+        printf("\n%d of %d TAs did not finish cleanly\n", failed, num_tas);
+    } else if (t->recoveries == 0) {
+        printf("\nAll TAs finished (no deadlock occurred)\n");
+    } else {
+        printf("\nAll TAs finished (%d deadlocks detected and recovered)\n", t->recoveries);
+    }
+    if (mode == MODE_DETECT) {
+        printf("Deadlock recovery: %d recoveries, %d cycle checks, detection latency "
+               "mean %.1f ms, max %.1f ms\n", t->recoveries, t->checks,
+               t->recoveries ? t->detect_us_total / 1e3 / t->recoveries : 0.0,
+               t->detect_us_max / 1e3);
+    }
 
     // Cleanup semaphores
-    sem_destroy(&data->rubric_sem);
-    sem_destroy(&data->questions_sem);
-    sem_destroy(&data->exam_sem);
+    lock_table_destroy(t);
 
     munmap(data, sizeof(SharedData));
-    return 0;
+    return failed > 0;
 }
\ No newline at end of file
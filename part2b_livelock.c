@@ -7,145 +7,304 @@
 #include <sys/mman.h>
 #include <semaphore.h>
 #include <time.h>
+#include <getopt.h>
 
-#define MAX_RUBRIC_LINES 5
-#define MAX_QUESTIONS 5
+#include "contention.h"
+
+#define MAX_TAS         64
+#define BACKOFF_MIN_US  1000    // first backoff window
+#define BACKOFF_MAX_US  64000   // widest backoff window
+#define HOLD_OUT_US     1000    // an older TA re-checks its second lock this often
+
+// What one TA went through to get both locks.
+typedef struct {
+    int attempts;                         // times it took its first lock
+    int wasted;                           // attempts that ended by releasing it again
+    int acquired;                         // 1 if it got both locks
+    int fell_back;                        // 1 if it got them by ordered acquisition
+    long long acquire_us;                 // start -> both locks held (or gave up)
+} TaResult;
 
 typedef struct {
-    int ta1_ready;
-    int ta2_ready;
-    sem_t lock1;
-    sem_t lock2;
+    int ready[MAX_TAS];   // --naive: TA holds its first lock and wants the other
+    sem_t locks[2];       // lock1 and lock2
     sem_t start_barrier;  // To synchronize start
+    sem_t start_go;       // posted once per TA when the last one arrives
     int started_count;
+    Arbiter arbiter;      // tickets and lock holders for contention management
+    TaResult results[MAX_TAS];
 } SharedData;
 
-void ta_process_livelock(int ta_id, SharedData *data) {
-    printf("TA %d: Started\n", ta_id);
-    fflush(stdout);
+// Options, set in main before forking.
+int num_tas = 2;
+int naive = 0;            // original fixed-delay politeness (livelocks)
+int fallback_after = 0;   // wasted attempts before ordered acquisition, 0 = never
+int max_attempts = 20;    // Limit attempts to prevent infinite loop
+
+long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
-    // Wait for both TAs to be ready
+// Blocks until every TA has arrived.
+void wait_for_start(SharedData *data) {
     sem_wait(&data->start_barrier);
-    data->started_count++;
-    if (data->started_count == 2) {
-        sem_post(&data->start_barrier);
-        sem_post(&data->start_barrier);  // Wakes up the other TA
-    } else {
-        sem_post(&data->start_barrier);
-        usleep(10000);  // Small delay to ensure both are ready
+    int last = ++data->started_count == num_tas;
+    sem_post(&data->start_barrier);
+
+    if (last) {
+        for (int i = 0; i < num_tas; i++) {
+            sem_post(&data->start_go);
+        }
     }
+    sem_wait(&data->start_go);
+}
 
-    printf("TA %d: Both TAs ready, beginning work\n", ta_id);
+// A TA of the other kind (odd/even) that is ready, or 0.
+int ready_rival(SharedData *data, int ta_id) {
+    for (int i = 0; i < num_tas; i++) {
+        if ((i + 1) % 2 != ta_id % 2 && data->ready[i]) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Holds both locks for a while, then releases them.
+void work_and_release(int ta_id, SharedData *data, int first, int second) {
+    printf("TA %d: Successfully acquired both locks!\n", ta_id);
     fflush(stdout);
 
-    int attempts = 0;
-    int max_attempts = 20;  // Limit attempts to prevent infinite loop
+    usleep(100000);
 
-    if (ta_id == 1) {
-        // TA 1 tries to be polite and yields if TA 2 is ready
-        while (attempts < max_attempts) {
-            printf("TA %d: Attempt %d - Acquiring lock1\n", ta_id, attempts + 1);
-            fflush(stdout);
-            sem_wait(&data->lock1);
-            data->ta1_ready = 1;
-
-            // Check if TA 2 is ready
-            if (data->ta2_ready == 1) {
-                printf("TA %d: Detected TA 2 is ready, being polite and releasing lock1\n", ta_id);
-                fflush(stdout);
-                data->ta1_ready = 0;
-                sem_post(&data->lock1);
-                usleep(50000);  // Small delay
-                attempts++;
-                continue;
-            }
+    arbiter_release(&data->arbiter, second);
+    sem_post(&data->locks[second]);
+    data->ready[ta_id - 1] = 0;
+    arbiter_release(&data->arbiter, first);
+    sem_post(&data->locks[first]);
+    printf("TA %d: Released both locks\n", ta_id);
+    fflush(stdout);
+}
 
-            // Try to acquire lock2
-            printf("TA %d: Trying to acquire lock2\n", ta_id);
+/* ---------------- original: polite fixed delay ---------------- */
+
+// Each TA yields whenever a rival is ready and retries after the same
+// fixed delay, so rivals stay in lockstep and keep yielding to each other.
+void polite_loop(int ta_id, SharedData *data, int first, int second, long long start) {
+    TaResult *r = &data->results[ta_id - 1];
+
+    while (r->attempts < max_attempts) {
+        printf("TA %d: Attempt %d - Acquiring lock%d\n", ta_id, r->attempts + 1, first + 1);
+        fflush(stdout);
+        sem_wait(&data->locks[first]);
+        data->ready[ta_id - 1] = 1;
+        r->attempts++;
+
+        // Check if a rival is ready
+        int rival = ready_rival(data, ta_id);
+        if (rival) {
+            printf("TA %d: Detected TA %d is ready, being polite and releasing lock%d\n",
+                   ta_id, rival, first + 1);
             fflush(stdout);
-            sem_wait(&data->lock2);
+            data->ready[ta_id - 1] = 0;
+            sem_post(&data->locks[first]);
+            r->wasted++;
+            usleep(50000);  // Small delay
+            continue;
+        }
 
-            // Success - both locks acquired
-            printf("TA %d: Successfully acquired both locks!\n", ta_id);
-            fflush(stdout);
+        // Try to acquire the other lock
+        printf("TA %d: Trying to acquire lock%d\n", ta_id, second + 1);
+        fflush(stdout);
+        sem_wait(&data->locks[second]);
 
-            usleep(100000);
+        // Success - both locks acquired
+        r->acquired = 1;
+        r->acquire_us = now_us() - start;
+        work_and_release(ta_id, data, first, second);
+        break;
+    }
+}
 
-            sem_post(&data->lock2);
-            data->ta1_ready = 0;
-            sem_post(&data->lock1);
-            printf("TA %d: Released both locks\n", ta_id);
-            fflush(stdout);
-            break;
-        }
+/* ---------------- contention managed ---------------- */
+
+// Wait-die on tickets: a TA that can't get its second lock keeps its
+// first only if it is older than the holder, otherwise releases it and
+// backs off for a jittered, growing delay. After fallback_after wasted
+// attempts it takes lock1 then lock2 in the global order instead.
+void managed_loop(int ta_id, SharedData *data, int first, int second, long long start) {
+    TaResult *r = &data->results[ta_id - 1];
+    Arbiter *a = &data->arbiter;
+    unsigned int ticket = arbiter_ticket(a);  // kept across retries, so it only ages
+
+    Backoff backoff;
+    backoff_init(&backoff, BACKOFF_MIN_US, BACKOFF_MAX_US,
+                 (unsigned int)time(NULL) ^ (ta_id * 2654435761u));
+
+    while (r->attempts < max_attempts) {
+        r->attempts++;
 
-        if (attempts >= max_attempts) {
-            printf("TA %d: LIVELOCK - Could not acquire both locks after %d attempts\n", ta_id, max_attempts);
+        if (fallback_after > 0 && r->wasted >= fallback_after) {
+            printf("TA %d: Attempt %d - %d attempts wasted, acquiring lock1 then lock2 in order\n",
+                   ta_id, r->attempts, r->wasted);
             fflush(stdout);
+            sem_wait(&data->locks[0]);
+            arbiter_hold(a, 0, ARBITER_ORDERED);
+            sem_wait(&data->locks[1]);
+            arbiter_hold(a, 1, ARBITER_ORDERED);
+
+            r->acquired = 1;
+            r->fell_back = 1;
+            r->acquire_us = now_us() - start;
+            work_and_release(ta_id, data, 0, 1);
+            return;
         }
-    } else if (ta_id == 2) {
-        // TA 2 tries to be polite and yields if TA 1 is ready
-        while (attempts < max_attempts) {
-            printf("TA %d: Attempt %d - Acquiring lock2\n", ta_id, attempts + 1);
-            fflush(stdout);
-            sem_wait(&data->lock2);
-            data->ta2_ready = 1;
-
-            // Check if TA 1 is ready
-            if (data->ta1_ready == 1) {
-                printf("TA %d: Detected TA 1 is ready, being polite and releasing lock2\n", ta_id);
-                fflush(stdout);
-                data->ta2_ready = 0;
-                sem_post(&data->lock2);
-                usleep(50000);  // Small delay
-                attempts++;
-                continue;
+
+        printf("TA %d: Attempt %d - Acquiring lock%d (ticket %u)\n",
+               ta_id, r->attempts, first + 1, ticket);
+        fflush(stdout);
+        sem_wait(&data->locks[first]);
+        arbiter_hold(a, first, ticket);
+
+        int got = 0;
+        for (;;) {
+            if (sem_trywait(&data->locks[second]) == 0) {
+                arbiter_hold(a, second, ticket);
+                got = 1;
+                break;
             }
+            if (arbiter_should_yield(a, second, ticket)) {
+                break;
+            }
+            usleep(HOLD_OUT_US); // older: the holder will yield or finish
+        }
 
-            // Try to acquire lock1
-            printf("TA %d: Trying to acquire lock1\n", ta_id);
-            fflush(stdout);
-            sem_wait(&data->lock1);
+        if (got) {
+            r->acquired = 1;
+            r->acquire_us = now_us() - start;
+            work_and_release(ta_id, data, first, second);
+            return;
+        }
 
-            // Success - both locks acquired
-            printf("TA %d: Successfully acquired both locks!\n", ta_id);
-            fflush(stdout);
+        long delay = backoff_next(&backoff);
+        printf("TA %d: lock%d is held by an older TA, releasing lock%d and backing off %.1f ms\n",
+               ta_id, second + 1, first + 1, delay / 1000.0);
+        fflush(stdout);
+        arbiter_release(a, first);
+        sem_post(&data->locks[first]);
+        r->wasted++;
+        usleep(delay);
+    }
+}
 
-            usleep(100000);
+void ta_process_livelock(int ta_id, SharedData *data) {
+    printf("TA %d: Started\n", ta_id);
+    fflush(stdout);
 
-            sem_post(&data->lock1);
-            data->ta2_ready = 0;
-            sem_post(&data->lock2);
-            printf("TA %d: Released both locks\n", ta_id);
-            fflush(stdout);
-            break;
-        }
+    // Wait for all TAs to be ready
+    wait_for_start(data);
 
-        if (attempts >= max_attempts) {
-            printf("TA %d: LIVELOCK - Could not acquire both locks after %d attempts\n", ta_id, max_attempts);
-            fflush(stdout);
-        }
+    printf("TA %d: All TAs ready, beginning work\n", ta_id);
+    fflush(stdout);
+
+    // Odd TAs want lock1 first, even TAs lock2 first
+    int first = ta_id % 2 == 1 ? 0 : 1;
+    int second = 1 - first;
+    long long start = now_us();
+
+    if (naive) {
+        polite_loop(ta_id, data, first, second, start);
+    } else {
+        managed_loop(ta_id, data, first, second, start);
+    }
+
+    TaResult *r = &data->results[ta_id - 1];
+    if (!r->acquired) {
+        r->acquire_us = now_us() - start;
+        printf("TA %d: LIVELOCK - Could not acquire both locks after %d attempts\n",
+               ta_id, max_attempts);
+        fflush(stdout);
     }
 
     printf("TA %d: Stopped\n", ta_id);
     fflush(stdout);
 }
 
+// Per-TA time to acquire and wasted attempts.
+void print_results(SharedData *data) {
+    int acquired = 0, wasted = 0;
+    long long total_us = 0, max_us = 0;
+
+    printf("  TA  acquired  attempts  wasted  time to acquire(ms)  path\n");
+    for (int i = 0; i < num_tas; i++) {
+        TaResult *r = &data->results[i];
+        const char *path = naive ? "polite" : r->fell_back ? "ordered" : "ticket";
+        printf("  %2d  %8s  %8d  %6d  %19.1f  %s\n", i + 1, r->acquired ? "yes" : "no",
+               r->attempts, r->wasted, r->acquire_us / 1e3, r->acquired ? path : "-");
+        acquired += r->acquired;
+        wasted += r->wasted;
+        total_us += r->acquire_us;
+        if (r->acquire_us > max_us) {
+            max_us = r->acquire_us;
+        }
+    }
+    printf("  %d of %d TAs acquired both locks; %d wasted attempts; "
+           "time to acquire mean %.1f ms, max %.1f ms\n",
+           acquired, num_tas, wasted, total_us / 1e3 / num_tas, max_us / 1e3);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n] [-k fallback_after] [-a max_attempts] <number_of_TAs>\n", prog);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <number_of_TAs>\n", argv[0]);
-        fprintf(stderr, "Note: This demonstration uses exactly 2 TAs\n");
+    static const struct option long_opts[] = {
+        {"naive",    no_argument,       NULL, 'n'},
+        {"fallback", required_argument, NULL, 'k'},
+        {"attempts", required_argument, NULL, 'a'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "nk:a:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            naive = 1;
+            break;
+        case 'k':
+            fallback_after = atoi(optarg);
+            break;
+        case 'a':
+            max_attempts = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || fallback_after < 0 || max_attempts < 1) {
+        usage(argv[0]);
         return 1;
     }
 
-    int num_tas = atoi(argv[1]);
-    if (num_tas < 2) {
-        fprintf(stderr, "Number of TAs must be at least 2\n");
+    num_tas = atoi(argv[optind]);
+    if (num_tas < 2 || num_tas > MAX_TAS) {
+        fprintf(stderr, "Number of TAs must be between 2 and %d\n", MAX_TAS);
         return 1;
     }
 
-    printf("Starting Part 2.b LIVELOCK DEMONSTRATION with 2 TAs\n");
-    printf("This version demonstrates a livelock scenario where TAs keep yielding to each other.\n");
+    printf("Starting Part 2.b LIVELOCK DEMONSTRATION with %d TAs\n", num_tas);
+    if (naive) {
+        printf("This version demonstrates a livelock scenario where TAs keep yielding to each other.\n");
+    } else {
+        printf("Contention managed: ticket arbitration, jittered backoff %d-%d ms",
+               BACKOFF_MIN_US / 1000, BACKOFF_MAX_US / 1000);
+        if (fallback_after > 0) {
+            printf(", ordered acquisition after %d wasted attempts", fallback_after);
+        }
+        printf(".\n");
+    }
     fflush(stdout);
 
     // Create shared memory
@@ -160,18 +319,16 @@ int main(int argc, char *argv[]) {
 
     // Initialize
     memset(data, 0, sizeof(SharedData));
-    data->ta1_ready = 0;
-    data->ta2_ready = 0;
-    data->started_count = 0;
 
     // Initialize semaphores
-    sem_init(&data->lock1, 1, 1);
-    sem_init(&data->lock2, 1, 1);
+    sem_init(&data->locks[0], 1, 1);
+    sem_init(&data->locks[1], 1, 1);
     sem_init(&data->start_barrier, 1, 1);
+    sem_init(&data->start_go, 1, 0);
 
-    // Fork exactly 2 TA processes for livelock demonstration
-    pid_t pids[2];
-    for (int i = 0; i < 2; i++) {
+    // Fork TA processes
+    pid_t pids[MAX_TAS];
+    for (int i = 0; i < num_tas; i++) {
         pids[i] = fork();
         if (pids[i] < 0) {
             perror("fork");
@@ -183,17 +340,19 @@ int main(int argc, char *argv[]) {
     }
 
     // Wait for TAs
-    for (int i = 0; i < 2; i++) {
+    for (int i = 0; i < num_tas; i++) {
         waitpid(pids[i], NULL, 0);
     }
 
     printf("\nAll TAs finished\n");
+    print_results(data);
 
     // Cleanup
-    sem_destroy(&data->lock1);
-    sem_destroy(&data->lock2);
+    sem_destroy(&data->locks[0]);
+    sem_destroy(&data->locks[1]);
     sem_destroy(&data->start_barrier);
+    sem_destroy(&data->start_go);
     munmap(data, sizeof(SharedData));
 
     return 0;
-}
\ No newline at end of file
+}